@@ -0,0 +1,474 @@
+#include "Archive.h"
+#include "Inflate.h"
+#include "FumenReader.h"
+#include "FumenLoader.h"
+#include "MyException.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/crc.hpp>
+
+//-------------------------------------------------------------------
+//little endian helpers
+//-------------------------------------------------------------------
+
+static std::uint32_t GetLe16(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return u[0] | (u[1] << 8);
+}
+
+static std::uint32_t GetLe32(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<std::uint32_t>(u[3]) << 24);
+}
+
+static void PutLe16(std::string& s, std::uint32_t v)
+{
+	s.push_back(static_cast<char>(v & 0xff));
+	s.push_back(static_cast<char>((v >> 8) & 0xff));
+}
+
+static void PutLe32(std::string& s, std::uint32_t v)
+{
+	PutLe16(s, v & 0xffff);
+	PutLe16(s, v >> 16);
+}
+
+static const std::uint32_t ZipLocalSignature = 0x04034b50;
+static const std::uint32_t ZipCentralSignature = 0x02014b50;
+static const std::uint32_t ZipEndSignature = 0x06054b50;
+static const std::uint32_t ZipUtf8Flag = 0x0800;
+
+static const int TarBlockSize = 512;
+
+static std::size_t ParseOctal(const char* p, int len)
+{
+	std::size_t r = 0;
+	for (int i = 0; i < len && p[i] != 0; ++i) {
+		if (p[i] >= '0' && p[i] <= '7')
+			r = r * 8 + (p[i] - '0');
+		else if (p[i] != ' ')
+			break;
+	}
+	return r;
+}
+
+//ustar magic and a header checksum that matches, which plain text never has
+static bool IsTarHeader(const char* header)
+{
+	//the checksum is computed with its own field filled by spaces
+	std::size_t sum = 0;
+	for (int i = 0; i < TarBlockSize; ++i)
+		sum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(header[i]);
+	return std::memcmp(header + 257, "ustar", 5) == 0 && ParseOctal(header + 148, 8) == sum;
+}
+
+//-------------------------------------------------------------------
+//impl for archive reader
+//-------------------------------------------------------------------
+
+ArchiveReader::ArchiveReader(const std::wstring& fileName)
+	: _fs(fileName.c_str(), std::ios::in | std::ios::binary), _fileSize(0), _isZip(false), _zipIndex(0)
+{
+	if (!_fs)
+		throw MyException("Cannot open archive file!");
+
+	_fs.seekg(0, std::ios::end);
+	_fileSize = _fs.tellg();
+	_fs.seekg(0);
+
+	char header[TarBlockSize] = { 0 };
+	_fs.read(header, TarBlockSize);
+	_fs.clear();
+	_fs.seekg(0);
+
+	if (header[0] == 'P' && header[1] == 'K' && (header[2] == 3 || header[2] == 5)) {
+		_isZip = true;
+		ReadZipDirectory();
+	} else if (_fileSize < TarBlockSize || (!IsTarHeader(header) && std::count(header, header + TarBlockSize, '\0') != TarBlockSize))
+		throw MyException("Archive Error: not a zip or tar archive");
+}
+
+void ArchiveReader::ReadZipDirectory()
+{
+	//the end of central directory record is followed by a comment of at most 65535 bytes
+	std::streamoff fileSize = _fileSize;
+	std::streamoff tailSize = std::min<std::streamoff>(fileSize, 22 + 65535);
+
+	std::string tail(static_cast<std::size_t>(tailSize), '\0');
+	_fs.seekg(fileSize - tailSize);
+	_fs.read(&tail[0], tailSize);
+
+	std::string::size_type endPos = std::string::npos;
+	for (std::string::size_type i = tail.size() >= 22 ? tail.size() - 22 + 1 : 0; i-- > 0; ) {
+		if (GetLe32(&tail[i]) == ZipEndSignature) {
+			endPos = i;
+			break;
+		}
+	}
+	if (endPos == std::string::npos)
+		throw MyException("Archive Error: zip end of central directory not found");
+
+	std::uint32_t nEntries = GetLe16(&tail[endPos + 10]);
+	std::uint32_t dirSize = GetLe32(&tail[endPos + 12]);
+	std::uint32_t dirOffset = GetLe32(&tail[endPos + 16]);
+	if (nEntries == 0xffff || dirOffset == 0xffffffff)
+		throw MyException("Archive Error: zip64 is not supported");
+	if (static_cast<std::streamoff>(dirOffset) + dirSize > fileSize)
+		throw MyException("Archive Error: bad zip central directory");
+
+	std::string dir(dirSize, '\0');
+	_fs.seekg(dirOffset);
+	if (dirSize != 0 && !_fs.read(&dir[0], dirSize))
+		throw MyException("Archive Error: cannot read zip central directory");
+
+	std::size_t pos = 0;
+	for (std::uint32_t i = 0; i < nEntries; ++i) {
+		if (pos + 46 > dir.size() || GetLe32(&dir[pos]) != ZipCentralSignature)
+			throw MyException("Archive Error: bad zip central directory");
+
+		ZipRecord r;
+		std::uint32_t flags = GetLe16(&dir[pos + 8]);
+		r.utf8Name = (flags & ZipUtf8Flag) != 0;
+		r.method = GetLe16(&dir[pos + 10]);
+		r.crc = GetLe32(&dir[pos + 16]);
+		r.compressedSize = GetLe32(&dir[pos + 20]);
+		r.size = GetLe32(&dir[pos + 24]);
+		std::uint32_t nameLen = GetLe16(&dir[pos + 28]);
+		std::uint32_t extraLen = GetLe16(&dir[pos + 30]);
+		std::uint32_t commentLen = GetLe16(&dir[pos + 32]);
+		r.localOffset = GetLe32(&dir[pos + 42]);
+
+		if (pos + 46 + nameLen > dir.size())
+			throw MyException("Archive Error: bad zip central directory");
+		r.name = dir.substr(pos + 46, nameLen);
+
+		//directories end with a slash
+		if (!r.name.empty() && r.name[r.name.length() - 1] != '/')
+			_zipRecords.push_back(r);
+
+		pos += 46 + nameLen + extraLen + commentLen;
+	}
+}
+
+bool ArchiveReader::ReadZipEntry(ArchiveEntry& e)
+{
+	if (_zipIndex >= _zipRecords.size())
+		return false;
+
+	const ZipRecord& r = _zipRecords[_zipIndex++];
+
+	char header[30];
+	_fs.seekg(r.localOffset);
+	if (!_fs.read(header, 30) || GetLe32(header) != ZipLocalSignature)
+		throw MyException("Archive Error: bad zip local header");
+
+	//sizes in the local header may be zero when a data descriptor is used, trust the central directory
+	std::uint32_t nameLen = GetLe16(header + 26);
+	std::uint32_t extraLen = GetLe16(header + 28);
+	std::streamoff dataOffset = static_cast<std::streamoff>(r.localOffset) + 30 + nameLen + extraLen;
+	if (dataOffset + r.compressedSize > _fileSize)
+		throw MyException("Archive Error: unexpected end of zip file");
+	_fs.seekg(dataOffset);
+
+	e.name = r.name;
+	e.utf8Name = r.utf8Name;
+	e.method = r.method;
+	e.crc = r.crc;
+	e.checkCrc = true;
+	e.size = r.size;
+	e.data.resize(r.compressedSize);
+	if (r.compressedSize != 0 && !_fs.read(&e.data[0], r.compressedSize))
+		throw MyException("Archive Error: unexpected end of zip file");
+
+	return true;
+}
+
+static std::string GetTarField(const char* p, int len)
+{
+	return std::string(p, std::find(p, p + len, '\0'));
+}
+
+bool ArchiveReader::ReadTarEntry(ArchiveEntry& e)
+{
+	std::string longName;
+
+	for (;;) {
+		char header[TarBlockSize];
+		if (!_fs.read(header, TarBlockSize))
+			return false;
+
+		//two zero blocks mark the end, one is enough for us
+		if (std::count(header, header + TarBlockSize, '\0') == TarBlockSize)
+			return false;
+
+		if (!IsTarHeader(header))
+			throw MyException("Archive Error: bad tar header");
+
+		std::size_t size = ParseOctal(header + 124, 12);
+		char type = header[156];
+		if (static_cast<std::streamoff>(size) > _fileSize - _fs.tellg())
+			throw MyException("Archive Error: unexpected end of tar file");
+
+		std::string data(size, '\0');
+		if (size != 0 && !_fs.read(&data[0], size))
+			throw MyException("Archive Error: unexpected end of tar file");
+		_fs.seekg((TarBlockSize - size % TarBlockSize) % TarBlockSize, std::ios::cur);
+
+		if (type == 'L') {
+			//gnu long name for the next entry
+			longName = GetTarField(data.c_str(), data.size());
+			continue;
+		} else if (type == 'x') {
+			//pax extended header, records look like "27 path=some/long/name.txt\n"
+			std::string::size_type pos = 0;
+			while (pos < data.size()) {
+				std::string::size_type space = data.find(' ', pos);
+				if (space == std::string::npos)
+					break;
+				std::size_t len = std::strtoul(data.c_str() + pos, NULL, 10);
+				if (len == 0 || pos + len > data.size() || space + 2 > pos + len)
+					break;
+				std::string record = data.substr(space + 1, pos + len - space - 2);
+				if (record.compare(0, 5, "path=") == 0)
+					longName = record.substr(5);
+				pos += len;
+			}
+			continue;
+		} else if (type != '0' && type != '\0') {
+			//directories, links, global pax headers...
+			longName.clear();
+			continue;
+		}
+
+		if (!longName.empty()) {
+			e.name = longName;
+		} else {
+			e.name = GetTarField(header, 100);
+			std::string prefix = GetTarField(header + 345, 155);
+			if (std::memcmp(header + 257, "ustar", 5) == 0 && !prefix.empty())
+				e.name = prefix + "/" + e.name;
+		}
+
+		e.utf8Name = true;
+		e.method = 0;
+		e.crc = 0;
+		e.checkCrc = false;
+		e.size = size;
+		e.data.swap(data);
+		return true;
+	}
+}
+
+bool ArchiveReader::ReadEntry(ArchiveEntry& e)
+{
+	if (_isZip)
+		return ReadZipEntry(e);
+	else
+		return ReadTarEntry(e);
+}
+
+//-------------------------------------------------------------------
+//impl for free functions
+//-------------------------------------------------------------------
+
+void DecompressEntry(const ArchiveEntry& e, std::string& out)
+{
+	out.clear();
+
+	if (e.method == 0) {
+		out = e.data;
+	} else if (e.method == 8) {
+		//deflate cannot expand more than about 1032 times, a bogus size must not reserve gigabytes
+		out.reserve(std::min<std::size_t>(e.size, e.data.size() * 1032));
+		Inflate(reinterpret_cast<const unsigned char*>(e.data.data()), e.data.size(), out, e.size);
+	} else
+		throw MyException("Archive Error: unsupported compression method");
+
+	if (out.size() != e.size)
+		throw MyException("Archive Error: size mismatch");
+
+	if (e.checkCrc) {
+		boost::crc_32_type crc;
+		crc.process_bytes(out.data(), out.size());
+		if (crc.checksum() != e.crc)
+			throw MyException("Archive Error: crc mismatch");
+	}
+}
+
+std::wstring GetEntryName(const std::string& name, bool utf8Name)
+{
+	if (utf8Name) {
+		try {
+			return FromUtf8(name);
+		} catch (std::exception&) {
+			//not really utf-8, fall through
+		}
+	}
+	return EncodingConv(name, GetJapaneseLocale());
+}
+
+bool IsArchiveFileName(const std::wstring& fileName)
+{
+	if (fileName.length() < 4)
+		return false;
+
+	std::wstring ext = fileName.substr(fileName.length() - 4);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+	return ext == L".zip" || ext == L".tar";
+}
+
+//-------------------------------------------------------------------
+//impl for archive writer
+//-------------------------------------------------------------------
+
+ArchiveWriter::ArchiveWriter(const std::wstring& fileName)
+	: _fs(fileName.c_str(), std::ios::out | std::ios::binary), _closed(false), _offset(0)
+{
+	if (!_fs)
+		throw MyException("Cannot open output archive!");
+
+	std::wstring ext = fileName.substr(fileName.length() >= 4 ? fileName.length() - 4 : 0);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+	_isZip = ext != L".tar";
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	try {
+		Close();
+	} catch (...) {
+	}
+}
+
+static void AppendTarHeader(std::string& s, const std::string& name, std::size_t size, char type)
+{
+	char header[TarBlockSize];
+	std::memset(header, 0, TarBlockSize);
+
+	std::memcpy(header, name.c_str(), std::min<std::size_t>(name.length(), 99));
+	std::sprintf(header + 100, "%07o", 0644);
+	std::sprintf(header + 108, "%07o", 0);
+	std::sprintf(header + 116, "%07o", 0);
+	std::sprintf(header + 124, "%011lo", static_cast<unsigned long>(size));
+	std::sprintf(header + 136, "%011o", 0);
+	header[156] = type;
+	std::memcpy(header + 257, "ustar", 6);
+	std::memcpy(header + 263, "00", 2);
+
+	//checksum is computed with its own field filled by spaces
+	std::memset(header + 148, ' ', 8);
+	unsigned int sum = 0;
+	for (int i = 0; i < TarBlockSize; ++i)
+		sum += static_cast<unsigned char>(header[i]);
+	std::sprintf(header + 148, "%06o", sum);
+	header[155] = ' ';
+
+	s.append(header, TarBlockSize);
+}
+
+static void AppendTarData(std::string& s, const std::string& data)
+{
+	s += data;
+	s.append((TarBlockSize - data.size() % TarBlockSize) % TarBlockSize, '\0');
+}
+
+void ArchiveWriter::AddEntry(const std::string& name, bool utf8Name, const std::string& data)
+{
+	if (_closed)
+		throw MyException("Internal Error: archive is already closed.");
+
+	std::string s;
+
+	if (_isZip) {
+		ZipRecord r;
+		boost::crc_32_type crc;
+		crc.process_bytes(data.data(), data.size());
+		r.name = name;
+		r.utf8Name = utf8Name;
+		r.crc = crc.checksum();
+		r.size = data.size();
+		r.localOffset = _offset;
+
+		PutLe32(s, ZipLocalSignature);
+		PutLe16(s, 10); //version needed
+		PutLe16(s, utf8Name ? ZipUtf8Flag : 0);
+		PutLe16(s, 0); //stored
+		PutLe16(s, 0); //time
+		PutLe16(s, 0x21); //date, 1980-01-01
+		PutLe32(s, r.crc);
+		PutLe32(s, r.size);
+		PutLe32(s, r.size);
+		PutLe16(s, name.length());
+		PutLe16(s, 0); //extra
+		s += name;
+		s += data;
+
+		_zipRecords.push_back(r);
+	} else {
+		if (name.length() > 99) {
+			AppendTarHeader(s, "././@LongLink", name.length() + 1, 'L');
+			AppendTarData(s, name + '\0');
+		}
+		AppendTarHeader(s, name, data.size(), '0');
+		AppendTarData(s, data);
+	}
+
+	_fs.write(s.data(), s.size());
+	if (!_fs)
+		throw MyException("Cannot write output archive!");
+	_offset += s.size();
+}
+
+void ArchiveWriter::Close()
+{
+	if (_closed)
+		return;
+	_closed = true;
+
+	std::string s;
+
+	if (_isZip) {
+		for (auto i = _zipRecords.cbegin(), e = _zipRecords.cend(); i != e; ++i) {
+			PutLe32(s, ZipCentralSignature);
+			PutLe16(s, 20); //version made by
+			PutLe16(s, 10); //version needed
+			PutLe16(s, i->utf8Name ? ZipUtf8Flag : 0);
+			PutLe16(s, 0); //stored
+			PutLe16(s, 0); //time
+			PutLe16(s, 0x21); //date
+			PutLe32(s, i->crc);
+			PutLe32(s, i->size);
+			PutLe32(s, i->size);
+			PutLe16(s, i->name.length());
+			PutLe16(s, 0); //extra
+			PutLe16(s, 0); //comment
+			PutLe16(s, 0); //disk
+			PutLe16(s, 0); //internal attributes
+			PutLe32(s, 0); //external attributes
+			PutLe32(s, i->localOffset);
+			s += i->name;
+		}
+
+		PutLe32(s, ZipEndSignature);
+		PutLe16(s, 0); //disk
+		PutLe16(s, 0); //disk of central directory
+		PutLe16(s, _zipRecords.size());
+		PutLe16(s, _zipRecords.size());
+		PutLe32(s, s.size() - 4 - 2 - 2 - 2 - 2);
+		PutLe32(s, _offset);
+		PutLe16(s, 0); //comment
+	} else {
+		s.append(TarBlockSize * 2, '\0');
+	}
+
+	_fs.write(s.data(), s.size());
+	_fs.close();
+	if (_fs.fail())
+		throw MyException("Cannot write output archive!");
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+//a regular file of a zip or tar archive, data is still compressed
+struct ArchiveEntry {
+	std::string name; //raw bytes of the name as stored
+	bool utf8Name;
+	int method; //0 stored, 8 deflate
+	std::uint32_t crc;
+	bool checkCrc; //tar has no crc
+	std::size_t size;
+	std::string data;
+};
+
+//reads entries one by one, zip or tar is detected from the content, anything else is rejected.
+//sizes are checked against the file, zip64 and multi-volume zip are not supported
+class ArchiveReader : boost::noncopyable {
+		struct ZipRecord {
+			std::string name;
+			bool utf8Name;
+			int method;
+			std::uint32_t crc;
+			std::uint32_t compressedSize;
+			std::uint32_t size;
+			std::uint32_t localOffset;
+		};
+
+		std::fstream _fs;
+		std::streamoff _fileSize;
+		bool _isZip;
+		std::vector<ZipRecord> _zipRecords;
+		std::size_t _zipIndex;
+
+		void ReadZipDirectory();
+		bool ReadZipEntry(ArchiveEntry& e);
+		bool ReadTarEntry(ArchiveEntry& e);
+	public:
+		ArchiveReader(const std::wstring& fileName);
+
+		//next regular file, false at the end of archive
+		bool ReadEntry(ArchiveEntry& e);
+};
+
+//decompress an entry and check its crc
+void DecompressEntry(const ArchiveEntry& e, std::string& out);
+
+//entry name for wide apis. zip names without the utf-8 flag are taken as shift-jis
+std::wstring GetEntryName(const std::string& name, bool utf8Name);
+
+//writes an uncompressed zip, or a tar when the file name ends with .tar
+class ArchiveWriter : boost::noncopyable {
+		struct ZipRecord {
+			std::string name;
+			bool utf8Name;
+			std::uint32_t crc;
+			std::uint32_t size;
+			std::uint32_t localOffset;
+		};
+
+		std::fstream _fs;
+		bool _isZip;
+		bool _closed;
+		std::vector<ZipRecord> _zipRecords;
+		std::uint32_t _offset;
+	public:
+		ArchiveWriter(const std::wstring& fileName);
+		~ArchiveWriter();
+
+		void AddEntry(const std::string& name, bool utf8Name, const std::string& data);
+		void Close();
+};
+
+//true for .zip and .tar file names
+bool IsArchiveFileName(const std::wstring& fileName);
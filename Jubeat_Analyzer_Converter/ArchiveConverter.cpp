@@ -0,0 +1,183 @@
+#include "ArchiveConverter.h"
+#include "Archive.h"
+#include "BoundedQueue.h"
+#include "FumenLoader.h"
+#include "FileUtil.h"
+#include "FumenTimeline.h"
+#include "YubiosiWriter.h"
+#include "MyException.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+namespace {
+
+struct RawFumen {
+	std::string name;
+	bool utf8Name;
+	std::string bytes;
+};
+
+struct ConvertedFumen {
+	std::string name;
+	bool utf8Name;
+	std::string bytes;
+	std::string error;
+};
+
+bool IsFumenEntry(const std::string& name)
+{
+	if (name.length() < 4)
+		return false;
+
+	//entry names may be shift-jis or utf-8, only ascii letters are lowered
+	std::string ext = name.substr(name.length() - 4);
+	for (auto i = ext.begin(), e = ext.end(); i != e; ++i) {
+		if (*i >= 'A' && *i <= 'Z')
+			*i += 'a' - 'A';
+	}
+	return ext == ".txt";
+}
+
+void JoinAll(std::vector<std::thread>& threads)
+{
+	for (auto i = threads.begin(), e = threads.end(); i != e; ++i)
+		i->join();
+}
+
+}
+
+int ConvertArchive(const std::wstring& input, const std::wstring& output, double speed, int nInflaters, int nConverters)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	nInflaters = max(nInflaters, 1);
+	nConverters = max(nConverters, 1);
+
+	ArchiveReader reader(input);
+	unique_ptr<ArchiveWriter> archiveWriter;
+	if (IsArchiveFileName(output))
+		archiveWriter.reset(new ArchiveWriter(output));
+
+	BoundedQueue<ArchiveEntry> compressed(nInflaters * 4);
+	BoundedQueue<RawFumen> decompressed(nConverters * 4);
+	BoundedQueue<ConvertedFumen> converted(nConverters * 4);
+
+	vector<thread> inflaters;
+	for (int i = 0; i < nInflaters; ++i) {
+		inflaters.push_back(thread([&]() {
+			ArchiveEntry e;
+			while (compressed.Pop(e)) {
+				RawFumen f;
+				f.name = e.name;
+				f.utf8Name = e.utf8Name;
+				try {
+					DecompressEntry(e, f.bytes);
+				} catch (exception& ex) {
+					//skip conversion, report it from the writer
+					ConvertedFumen c;
+					c.name = e.name;
+					c.utf8Name = e.utf8Name;
+					c.error = ex.what();
+					converted.Push(move(c));
+					continue;
+				}
+				decompressed.Push(move(f));
+			}
+		}));
+	}
+
+	vector<thread> converters;
+	for (int i = 0; i < nConverters; ++i) {
+		converters.push_back(thread([&]() {
+			vector<double> speeds(1, speed);
+			RawFumen f;
+			while (decompressed.Pop(f)) {
+				ConvertedFumen c;
+				c.name = f.name;
+				c.utf8Name = f.utf8Name;
+				try {
+					FumenTimeline t;
+					ParseFumenBytes(f.bytes, t);
+
+					vector<YubiosiVariant> variants;
+					ScaleYubiosiVariants(t, speeds, variants);
+					SaveYubiosiToBytes(t, variants[0], GetFumenName(GetBaseName(GetEntryName(f.name, f.utf8Name))), c.bytes);
+				} catch (exception& ex) {
+					c.error = ex.what();
+				}
+				converted.Push(move(c));
+			}
+		}));
+	}
+
+	exception_ptr writeError;
+	int nConverted = 0, nFailed = 0;
+	thread writer([&]() {
+		ConvertedFumen c;
+		while (converted.Pop(c)) {
+			if (!c.error.empty()) {
+				cerr << c.name << ": " << c.error << endl;
+				++nFailed;
+				continue;
+			}
+
+			//keep draining after a write error so the other stages can finish
+			if (writeError)
+				continue;
+
+			try {
+				if (archiveWriter) {
+					archiveWriter->AddEntry(c.name, c.utf8Name, c.bytes);
+				} else {
+					wstring fileName = GetEntryName(c.name, c.utf8Name);
+					replace(fileName.begin(), fileName.end(), L'/', L'_');
+					replace(fileName.begin(), fileName.end(), L'\\', L'_');
+
+					fstream fs((output + L"/" + fileName).c_str(), std::ios::out | std::ios::binary);
+					if (!fs)
+						throw MyException("Cannot open output file!");
+					fs.write(c.bytes.data(), c.bytes.size());
+				}
+				++nConverted;
+			} catch (...) {
+				writeError = current_exception();
+			}
+		}
+	});
+
+	exception_ptr readError;
+	try {
+		ArchiveEntry e;
+		while (reader.ReadEntry(e)) {
+			if (IsFumenEntry(e.name))
+				compressed.Push(move(e));
+			e = ArchiveEntry();
+		}
+	} catch (...) {
+		readError = current_exception();
+	}
+
+	compressed.Close();
+	JoinAll(inflaters);
+	decompressed.Close();
+	JoinAll(converters);
+	converted.Close();
+	writer.join();
+
+	if (readError)
+		rethrow_exception(readError);
+	if (writeError)
+		rethrow_exception(writeError);
+	if (archiveWriter)
+		archiveWriter->Close();
+
+	cout << "converted: " << nConverted << " failed: " << nFailed << endl;
+	return nFailed;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+//convert every .txt entry of a zip or tar archive to yubiosi without extracting it.
+//entries are read on the calling thread, decompressed on nInflaters threads,
+//converted on nConverters threads and written on one thread, with bounded queues in between.
+//output is a .zip or .tar archive, or otherwise a directory. returns the number of entries that failed,
+//an archive that cannot be read throws
+int ConvertArchive(const std::wstring& input, const std::wstring& output, double speed, int nInflaters, int nConverters);
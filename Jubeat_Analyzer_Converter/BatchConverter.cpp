@@ -0,0 +1,204 @@
+#include "BatchConverter.h"
+#include "BoundedQueue.h"
+#include "FileUtil.h"
+#include "FumenLoader.h"
+#include "FumenTimeline.h"
+#include "YubiosiWriter.h"
+#include "MyException.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+namespace {
+
+struct ReadItem {
+	std::size_t job;
+	std::string bytes;
+};
+
+struct WriteItem {
+	std::size_t job;
+	std::string bytes;
+};
+
+template<class T>
+BatchQueueStats GetQueueStats(const BoundedQueue<T>& q)
+{
+	BatchQueueStats r;
+	r.capacity = q.GetCapacity();
+	r.maxDepth = q.GetMaxDepth();
+	r.pushWaits = q.GetPushWaits();
+	r.popWaits = q.GetPopWaits();
+	return r;
+}
+
+void JoinAll(std::vector<std::thread>& threads)
+{
+	for (auto i = threads.begin(), e = threads.end(); i != e; ++i)
+		i->join();
+}
+
+}
+
+BatchConverter::BatchConverter(int nReaders, int nWorkers, int nWriters, std::size_t queueCapacity)
+	: _nReaders(std::max(nReaders, 1)), _nWorkers(std::max(nWorkers, 1)), _nWriters(std::max(nWriters, 1)),
+	_queueCapacity(queueCapacity)
+{
+}
+
+BatchStats BatchConverter::Run(const std::vector<BatchJob>& jobs)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	BoundedQueue<ReadItem> readQueue(_queueCapacity);
+	BoundedQueue<WriteItem> writeQueue(_queueCapacity);
+
+	atomic<size_t> nextJob(0);
+	atomic<int> nConverted(0), nFailed(0);
+	mutex errMutex;
+
+	auto reportError = [&](size_t job, const char* what) {
+		lock_guard<mutex> lock(errMutex);
+		cerr << ToUtf8(jobs[job].input) << ": " << what << endl;
+		++nFailed;
+	};
+
+	vector<thread> readers;
+	for (int i = 0; i < _nReaders; ++i) {
+		readers.push_back(thread([&]() {
+			for (size_t job; (job = nextJob++) < jobs.size(); ) {
+				try {
+					ReadItem r;
+					r.job = job;
+					if (!ReadFileBytes(jobs[job].input, r.bytes))
+						throw MyException("Cannot open input file!");
+					readQueue.Push(move(r));
+				} catch (exception& e) {
+					reportError(job, e.what());
+				}
+			}
+		}));
+	}
+
+	vector<thread> workers;
+	for (int i = 0; i < _nWorkers; ++i) {
+		workers.push_back(thread([&]() {
+			ReadItem r;
+			while (readQueue.Pop(r)) {
+				const BatchJob& job = jobs[r.job];
+				try {
+					FumenTimeline t;
+					ParseFumenBytes(r.bytes, t);
+
+					vector<YubiosiVariant> variants;
+					ScaleYubiosiVariants(t, vector<double>(1, job.speed), variants);
+
+					WriteItem w;
+					w.job = r.job;
+					SaveYubiosiToBytes(t, variants[0], GetFumenName(GetBaseName(job.output)), w.bytes);
+					writeQueue.Push(move(w));
+				} catch (exception& e) {
+					reportError(r.job, e.what());
+				}
+			}
+		}));
+	}
+
+	vector<thread> writers;
+	for (int i = 0; i < _nWriters; ++i) {
+		writers.push_back(thread([&]() {
+			WriteItem w;
+			while (writeQueue.Pop(w)) {
+				//text mode, the same line endings as the single file conversion
+				fstream fs(jobs[w.job].output.c_str(), std::ios::out);
+				fs.write(w.bytes.data(), w.bytes.size());
+				fs.close();
+				if (fs.fail())
+					reportError(w.job, "Cannot write output file!");
+				else
+					++nConverted;
+			}
+		}));
+	}
+
+	JoinAll(readers);
+	readQueue.Close();
+	JoinAll(workers);
+	writeQueue.Close();
+	JoinAll(writers);
+
+	BatchStats stats;
+	stats.converted = nConverted;
+	stats.failed = nFailed;
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	stats.readQueue = GetQueueStats(readQueue);
+	stats.writeQueue = GetQueueStats(writeQueue);
+	return stats;
+}
+
+void GetDirectoryBatchJobs(const std::wstring& inputDir, const std::wstring& outputDir, double speed, std::vector<BatchJob>& jobs)
+{
+	std::vector<std::wstring> files;
+	ListFiles(inputDir, L".txt", false, files);
+
+	for (auto i = files.cbegin(), e = files.cend(); i != e; ++i) {
+		BatchJob job;
+		job.input = *i;
+		job.output = JoinPath(outputDir, GetBaseName(*i));
+		job.speed = speed;
+		jobs.push_back(job);
+	}
+}
+
+void GetListBatchJobs(const std::wstring& listFile, std::vector<BatchJob>& jobs)
+{
+	std::fstream fs(listFile.c_str(), std::ios::in);
+	if (!fs)
+		throw MyException("Cannot open list file!");
+
+	std::string line;
+	while (std::getline(fs, line)) {
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+		if (line.empty())
+			continue;
+
+		std::string::size_type tab1 = line.find('\t');
+		if (tab1 == std::string::npos)
+			throw MyException("List file lines must be input<tab>output[<tab>speed]");
+		std::string::size_type tab2 = line.find('\t', tab1 + 1);
+
+		BatchJob job;
+		job.input = FromUtf8(line.substr(0, tab1));
+		job.output = FromUtf8(line.substr(tab1 + 1, tab2 == std::string::npos ? std::string::npos : tab2 - tab1 - 1));
+		job.speed = tab2 == std::string::npos ? 1 : boost::lexical_cast<double>(line.substr(tab2 + 1));
+		if (job.speed <= 0)
+			throw MyException("Speed must be positive!");
+		jobs.push_back(job);
+	}
+}
+
+static void PrintQueueStats(std::ostream& s, const char* name, const BatchQueueStats& q)
+{
+	s << name << ": capacity " << q.capacity << ", max depth " << q.maxDepth
+		<< ", waits on full " << q.pushWaits << ", waits on empty " << q.popWaits << std::endl;
+}
+
+void PrintBatchStats(std::ostream& s, const BatchStats& stats)
+{
+	s << "converted: " << stats.converted << " failed: " << stats.failed
+		<< " in " << stats.seconds << "s" << std::endl;
+	PrintQueueStats(s, "read queue", stats.readQueue);
+	PrintQueueStats(s, "write queue", stats.writeQueue);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <ostream>
+
+struct BatchJob {
+	std::wstring input;
+	std::wstring output;
+	double speed;
+};
+
+struct BatchQueueStats {
+	std::size_t capacity;
+	std::size_t maxDepth;
+	std::size_t pushWaits; //producer found it full, the consumer stage is the bottleneck
+	std::size_t popWaits; //consumer found it empty, the producer stage is the bottleneck
+};
+
+struct BatchStats {
+	int converted;
+	int failed;
+	double seconds;
+	BatchQueueStats readQueue;
+	BatchQueueStats writeQueue;
+};
+
+//converts many files with reading, parsing and writing overlapped:
+//nReaders threads prefetch input files, nWorkers threads parse and convert,
+//nWriters threads write outputs. the two bounded queues in between cap the memory in flight
+class BatchConverter : boost::noncopyable {
+		int _nReaders;
+		int _nWorkers;
+		int _nWriters;
+		std::size_t _queueCapacity;
+	public:
+		BatchConverter(int nReaders, int nWorkers, int nWriters, std::size_t queueCapacity);
+
+		BatchStats Run(const std::vector<BatchJob>& jobs);
+};
+
+//jobs from a directory of .txt files into another directory
+void GetDirectoryBatchJobs(const std::wstring& inputDir, const std::wstring& outputDir, double speed, std::vector<BatchJob>& jobs);
+
+//jobs from a utf-8 list file, one "input<tab>output[<tab>speed]" per line
+void GetListBatchJobs(const std::wstring& listFile, std::vector<BatchJob>& jobs);
+
+void PrintBatchStats(std::ostream& s, const BatchStats& stats);
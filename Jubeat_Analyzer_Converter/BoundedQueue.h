@@ -0,0 +1,99 @@
+#pragma once
+
+#include <boost/utility.hpp>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//blocking queue with a capacity, producers wait when it is full
+//after Close, Push fails and Pop drains what is left and then fails
+template<class T>
+class BoundedQueue : boost::noncopyable {
+		std::deque<T> _items;
+		std::size_t _capacity;
+		std::size_t _maxDepth;
+		std::size_t _pushWaits;
+		std::size_t _popWaits;
+		bool _closed;
+
+		mutable std::mutex _mutex;
+		std::condition_variable _notFull;
+		std::condition_variable _notEmpty;
+	public:
+		BoundedQueue(std::size_t capacity) : _capacity(capacity), _maxDepth(0), _pushWaits(0), _popWaits(0), _closed(false)
+		{
+			if (_capacity == 0)
+				_capacity = 1;
+		}
+
+		bool Push(T item)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (!_closed && _items.size() >= _capacity)
+				++_pushWaits;
+			while (!_closed && _items.size() >= _capacity)
+				_notFull.wait(lock);
+			if (_closed)
+				return false;
+
+			_items.push_back(std::move(item));
+			if (_items.size() > _maxDepth)
+				_maxDepth = _items.size();
+			_notEmpty.notify_one();
+			return true;
+		}
+
+		bool Pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (!_closed && _items.empty())
+				++_popWaits;
+			while (!_closed && _items.empty())
+				_notEmpty.wait(lock);
+			if (_items.empty())
+				return false;
+
+			item = std::move(_items.front());
+			_items.pop_front();
+			_notFull.notify_one();
+			return true;
+		}
+
+		void Close()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_closed = true;
+			_notFull.notify_all();
+			_notEmpty.notify_all();
+		}
+
+		std::size_t GetDepth() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _items.size();
+		}
+
+		std::size_t GetMaxDepth() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _maxDepth;
+		}
+
+		//how many times producers found the queue full, and consumers found it empty
+		std::size_t GetPushWaits() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _pushWaits;
+		}
+
+		std::size_t GetPopWaits() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _popWaits;
+		}
+
+		std::size_t GetCapacity() const
+		{
+			return _capacity;
+		}
+};
@@ -0,0 +1,260 @@
+#include "FileUtil.h"
+#include "FumenLoader.h"
+
+#include <algorithm>
+#include <cwctype>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+bool HasExtension(const std::wstring& name, const std::wstring& ext)
+{
+	if (name.length() < ext.length())
+		return false;
+
+	for (std::wstring::size_type i = 0, off = name.length() - ext.length(); i < ext.length(); ++i)
+		if (std::towlower(name[off + i]) != std::towlower(ext[i]))
+			return false;
+	return true;
+}
+
+std::wstring JoinPath(const std::wstring& dir, const std::wstring& name)
+{
+	if (dir.empty())
+		return name;
+
+	wchar_t last = dir[dir.length() - 1];
+	if (last == L'\\' || last == L'/')
+		return dir + name;
+#ifdef _WIN32
+	return dir + L"\\" + name;
+#else
+	return dir + L"/" + name;
+#endif
+}
+
+std::wstring GetBaseName(const std::wstring& path)
+{
+	std::wstring::size_type slash = path.find_last_of(L"\\/");
+	return slash == std::wstring::npos ? path : path.substr(slash + 1);
+}
+
+#ifdef _WIN32
+
+bool IsDirectory(const std::wstring& path)
+{
+	DWORD attr = GetFileAttributesW(path.c_str());
+	return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+static void ListFilesImpl(const std::wstring& dir, const std::wstring& ext, bool recursive, std::vector<std::wstring>& files)
+{
+	WIN32_FIND_DATAW fd;
+	HANDLE h = FindFirstFileW(JoinPath(dir, L"*").c_str(), &fd);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		std::wstring name = fd.cFileName;
+		if (name == L"." || name == L"..")
+			continue;
+
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+			if (recursive)
+				ListFilesImpl(JoinPath(dir, name), ext, recursive, files);
+		} else if (HasExtension(name, ext))
+			files.push_back(JoinPath(dir, name));
+	} while (FindNextFileW(h, &fd));
+
+	FindClose(h);
+}
+
+std::int64_t GetFileMTime(const std::wstring& path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+		return -1;
+
+	//100ns intervals since 1601-01-01
+	std::int64_t t = (static_cast<std::int64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+	return t / 10000000 - 11644473600LL;
+}
+
+bool RenameFile(const std::wstring& source, const std::wstring& dest)
+{
+	return MoveFileExW(source.c_str(), dest.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+MappedFile::MappedFile()
+	: _data(NULL), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(NULL)
+{
+}
+
+bool MappedFile::Open(const std::wstring& path)
+{
+	Close();
+
+	_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size) || size.HighPart != 0) {
+		Close();
+		return false;
+	}
+	_size = size.LowPart;
+
+	//an empty file cannot be mapped, but it is a valid empty view
+	if (_size == 0)
+		return true;
+
+	_mapping = CreateFileMappingW(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_mapping == NULL) {
+		Close();
+		return false;
+	}
+
+	_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_data == NULL) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (_data != NULL)
+		UnmapViewOfFile(_data);
+	if (_mapping != NULL)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+
+	_data = NULL;
+	_size = 0;
+	_mapping = NULL;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool IsDirectory(const std::wstring& path)
+{
+	struct stat st;
+	return stat(ToUtf8(path).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void ListFilesImpl(const std::wstring& dir, const std::wstring& ext, bool recursive, std::vector<std::wstring>& files)
+{
+	DIR* d = opendir(ToUtf8(dir).c_str());
+	if (d == NULL)
+		return;
+
+	while (dirent* ent = readdir(d)) {
+		std::wstring name = FromUtf8(ent->d_name);
+		if (name == L"." || name == L"..")
+			continue;
+
+		std::wstring path = JoinPath(dir, name);
+		if (IsDirectory(path)) {
+			if (recursive)
+				ListFilesImpl(path, ext, recursive, files);
+		} else if (HasExtension(name, ext))
+			files.push_back(path);
+	}
+
+	closedir(d);
+}
+
+std::int64_t GetFileMTime(const std::wstring& path)
+{
+	struct stat st;
+	if (stat(ToUtf8(path).c_str(), &st) != 0)
+		return -1;
+	return st.st_mtime;
+}
+
+bool RenameFile(const std::wstring& source, const std::wstring& dest)
+{
+	return std::rename(ToUtf8(source).c_str(), ToUtf8(dest).c_str()) == 0;
+}
+
+MappedFile::MappedFile()
+	: _data(NULL), _size(0), _fd(-1)
+{
+}
+
+bool MappedFile::Open(const std::wstring& path)
+{
+	Close();
+
+	_fd = open(ToUtf8(path).c_str(), O_RDONLY);
+	if (_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0) {
+		Close();
+		return false;
+	}
+	_size = st.st_size;
+
+	if (_size == 0)
+		return true;
+
+	void* p = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+	if (p == MAP_FAILED) {
+		Close();
+		return false;
+	}
+	_data = static_cast<const char*>(p);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (_data != NULL)
+		munmap(const_cast<char*>(_data), _size);
+	if (_fd >= 0)
+		close(_fd);
+
+	_data = NULL;
+	_size = 0;
+	_fd = -1;
+}
+
+#endif
+
+void ListFiles(const std::wstring& dir, const std::wstring& ext, bool recursive, std::vector<std::wstring>& files)
+{
+	files.clear();
+	ListFilesImpl(dir, ext, recursive, files);
+	std::sort(files.begin(), files.end());
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+const char* MappedFile::GetData() const
+{
+	return _data;
+}
+
+std::size_t MappedFile::GetSize() const
+{
+	return _size;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+bool IsDirectory(const std::wstring& path);
+
+//full paths of the files under a directory whose name ends with ext (case insensitive), sorted
+void ListFiles(const std::wstring& dir, const std::wstring& ext, bool recursive, std::vector<std::wstring>& files);
+
+//last write time in seconds since epoch, -1 if the file does not exist
+std::int64_t GetFileMTime(const std::wstring& path);
+
+std::wstring JoinPath(const std::wstring& dir, const std::wstring& name);
+
+//file name without directory
+std::wstring GetBaseName(const std::wstring& path);
+
+//true if name ends with ext, case insensitive
+bool HasExtension(const std::wstring& name, const std::wstring& ext);
+
+//replace dest with source, dest may exist
+bool RenameFile(const std::wstring& source, const std::wstring& dest);
+
+//read-only memory mapping of a whole file
+class MappedFile : boost::noncopyable {
+		const char* _data;
+		std::size_t _size;
+#ifdef _WIN32
+		void* _file;
+		void* _mapping;
+#else
+		int _fd;
+#endif
+	public:
+		MappedFile();
+		~MappedFile();
+
+		//false if the file cannot be opened or mapped
+		bool Open(const std::wstring& path);
+		void Close();
+
+		const char* GetData() const;
+		std::size_t GetSize() const;
+};
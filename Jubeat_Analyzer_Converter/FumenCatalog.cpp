@@ -0,0 +1,306 @@
+#include "FumenCatalog.h"
+#include "FumenLoader.h"
+#include "MyException.h"
+
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/crc.hpp>
+
+static const char CatalogMagic[8] = { 'J', 'A', 'C', 'A', 'T', 'L', 'G', '2' };
+static const std::size_t CatalogHeaderSize = 16;
+static const std::size_t CatalogRowSize = 8 * 4 + 4 * 8;
+
+void MakeCatalogRecord(const FumenTimeline& t, CatalogRecord& r)
+{
+	const std::vector<TimelineShousetsu>& shousetsus = t.GetShousetsus();
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+
+	r.musicFile = ToUtf8(t.GetMusicFile());
+	r.keys = t.GetKeysCount();
+	r.bars = shousetsus.size();
+	r.length = static_cast<float>(t.GetLength());
+	r.avgDensity = r.length > 0 ? r.keys / r.length : 0;
+
+	r.minTempo = r.maxTempo = 0;
+	for (auto i = shousetsus.cbegin(), e = shousetsus.cend(); i != e; ++i) {
+		if (i == shousetsus.cbegin() || i->tempo < r.minTempo) r.minTempo = i->tempo;
+		if (i == shousetsus.cbegin() || i->tempo > r.maxTempo) r.maxTempo = i->tempo;
+	}
+
+	//sliding one second window over the hakus
+	int peak = 0, inWindow = 0;
+	for (std::size_t head = 0, tail = 0; head < hakus.size(); ++head) {
+		inWindow += CountKeys(hakus[head].keys);
+		while (hakus[head].time - hakus[tail].time >= 1.0)
+			inWindow -= CountKeys(hakus[tail++].keys);
+		peak = std::max(peak, inWindow);
+	}
+	r.peakDensity = static_cast<float>(peak);
+}
+
+CatalogFilter::CatalogFilter()
+	: minTempo(0), maxTempo(std::numeric_limits<double>::max()),
+	minKeys(0), maxKeys(std::numeric_limits<int>::max()),
+	minLength(0), maxLength(std::numeric_limits<double>::max()),
+	minDensity(0), maxDensity(std::numeric_limits<double>::max())
+{
+}
+
+//-------------------------------------------------------------------
+//impl for catalog view
+//-------------------------------------------------------------------
+
+CatalogView::CatalogView()
+	: _count(0)
+{
+}
+
+bool CatalogView::Open(const std::wstring& indexFile)
+{
+	Close();
+
+	if (!_file.Open(indexFile))
+		return false;
+
+	const char* p = _file.GetData();
+	std::size_t size = _file.GetSize();
+	if (size < CatalogHeaderSize || std::memcmp(p, CatalogMagic, 8) != 0)
+		throw MyException("Catalog Error: not a catalog index");
+
+	std::uint32_t count, stringsSize;
+	std::memcpy(&count, p + 8, 4);
+	std::memcpy(&stringsSize, p + 12, 4);
+	if (size != CatalogHeaderSize + static_cast<std::size_t>(count) * CatalogRowSize + stringsSize)
+		throw MyException("Catalog Error: index size mismatch");
+
+	//8 byte columns come first so every column stays aligned in the mapping
+	const char* col = p + CatalogHeaderSize;
+	_mtime = reinterpret_cast<const std::int64_t*>(col); col += 8 * count;
+	_size = reinterpret_cast<const std::int64_t*>(col); col += 8 * count;
+	_minTempo = reinterpret_cast<const double*>(col); col += 8 * count;
+	_maxTempo = reinterpret_cast<const double*>(col); col += 8 * count;
+	_crc = reinterpret_cast<const std::uint32_t*>(col); col += 4 * count;
+	_keys = reinterpret_cast<const std::int32_t*>(col); col += 4 * count;
+	_bars = reinterpret_cast<const std::int32_t*>(col); col += 4 * count;
+	_length = reinterpret_cast<const float*>(col); col += 4 * count;
+	_avgDensity = reinterpret_cast<const float*>(col); col += 4 * count;
+	_peakDensity = reinterpret_cast<const float*>(col); col += 4 * count;
+	_pathOffset = reinterpret_cast<const std::uint32_t*>(col); col += 4 * count;
+	_musicOffset = reinterpret_cast<const std::uint32_t*>(col); col += 4 * count;
+	_strings = col;
+
+	for (std::uint32_t i = 0; i < count; ++i)
+		if (_pathOffset[i] >= stringsSize || _musicOffset[i] >= stringsSize)
+			throw MyException("Catalog Error: bad string offset");
+	if (stringsSize != 0 && _strings[stringsSize - 1] != '\0')
+		throw MyException("Catalog Error: bad string pool");
+
+	_count = count;
+	return true;
+}
+
+void CatalogView::Close()
+{
+	_file.Close();
+	_count = 0;
+}
+
+std::size_t CatalogView::GetCount() const
+{
+	return _count;
+}
+
+void CatalogView::GetRecord(std::size_t i, CatalogRecord& r) const
+{
+	r.path = _strings + _pathOffset[i];
+	r.musicFile = _strings + _musicOffset[i];
+	r.mtime = _mtime[i];
+	r.size = _size[i];
+	r.crc = _crc[i];
+	r.minTempo = _minTempo[i];
+	r.maxTempo = _maxTempo[i];
+	r.keys = _keys[i];
+	r.bars = _bars[i];
+	r.length = _length[i];
+	r.avgDensity = _avgDensity[i];
+	r.peakDensity = _peakDensity[i];
+}
+
+void CatalogView::Query(const CatalogFilter& f, std::vector<std::size_t>& rows) const
+{
+	rows.clear();
+	if (_count == 0)
+		return;
+
+	//min tempo <= max tempo, so a fumen within [f.minTempo, f.maxTempo] has its max tempo in it too
+	std::size_t begin = std::lower_bound(_maxTempo, _maxTempo + _count, f.minTempo) - _maxTempo;
+	std::size_t end = std::upper_bound(_maxTempo, _maxTempo + _count, f.maxTempo) - _maxTempo;
+
+	for (std::size_t i = begin; i < end; ++i) {
+		if (_minTempo[i] < f.minTempo) continue;
+		if (_keys[i] < f.minKeys || _keys[i] > f.maxKeys) continue;
+		if (_length[i] < f.minLength || _length[i] > f.maxLength) continue;
+		if (_avgDensity[i] < f.minDensity || _avgDensity[i] > f.maxDensity) continue;
+		if (!f.music.empty() && std::strstr(_strings + _musicOffset[i], f.music.c_str()) == NULL) continue;
+		rows.push_back(i);
+	}
+}
+
+//-------------------------------------------------------------------
+//impl for catalog building
+//-------------------------------------------------------------------
+
+template<class T>
+static void AppendColumn(std::string& s, const std::vector<CatalogRecord>& records, T CatalogRecord::*field)
+{
+	for (auto i = records.cbegin(), e = records.cend(); i != e; ++i) {
+		T v = (*i).*field;
+		s.append(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+}
+
+template<class T, class F>
+static void AppendColumnAs(std::string& s, const std::vector<CatalogRecord>& records, F CatalogRecord::*field)
+{
+	for (auto i = records.cbegin(), e = records.cend(); i != e; ++i) {
+		T v = static_cast<T>((*i).*field);
+		s.append(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+}
+
+void SaveCatalog(std::vector<CatalogRecord>& records, const std::wstring& indexFile)
+{
+	std::sort(records.begin(), records.end(), [](const CatalogRecord& a, const CatalogRecord& b) -> bool {
+		if (a.maxTempo != b.maxTempo) return a.maxTempo < b.maxTempo;
+		return a.path < b.path;
+	});
+
+	std::string strings;
+	std::vector<std::uint32_t> pathOffsets, musicOffsets;
+	for (auto i = records.cbegin(), e = records.cend(); i != e; ++i) {
+		pathOffsets.push_back(strings.size());
+		strings.append(i->path.c_str(), i->path.length() + 1);
+		musicOffsets.push_back(strings.size());
+		strings.append(i->musicFile.c_str(), i->musicFile.length() + 1);
+	}
+
+	std::uint32_t count = records.size();
+	std::uint32_t stringsSize = strings.size();
+
+	std::string s;
+	s.reserve(CatalogHeaderSize + count * CatalogRowSize + stringsSize);
+	s.append(CatalogMagic, 8);
+	s.append(reinterpret_cast<const char*>(&count), 4);
+	s.append(reinterpret_cast<const char*>(&stringsSize), 4);
+
+	AppendColumnAs<std::int64_t>(s, records, &CatalogRecord::mtime);
+	AppendColumnAs<std::int64_t>(s, records, &CatalogRecord::size);
+	AppendColumn(s, records, &CatalogRecord::minTempo);
+	AppendColumn(s, records, &CatalogRecord::maxTempo);
+	AppendColumnAs<std::uint32_t>(s, records, &CatalogRecord::crc);
+	AppendColumnAs<std::int32_t>(s, records, &CatalogRecord::keys);
+	AppendColumnAs<std::int32_t>(s, records, &CatalogRecord::bars);
+	AppendColumn(s, records, &CatalogRecord::length);
+	AppendColumn(s, records, &CatalogRecord::avgDensity);
+	AppendColumn(s, records, &CatalogRecord::peakDensity);
+	if (count != 0) {
+		s.append(reinterpret_cast<const char*>(&pathOffsets[0]), 4 * count);
+		s.append(reinterpret_cast<const char*>(&musicOffsets[0]), 4 * count);
+	}
+	s += strings;
+
+	//write aside and swap, so readers never map a half written index
+	std::wstring tmpFile = indexFile + L".tmp";
+	{
+		std::fstream fs(tmpFile.c_str(), std::ios::out | std::ios::binary);
+		fs.write(s.data(), s.size());
+		fs.close();
+		if (fs.fail())
+			throw MyException("Cannot write catalog index!");
+	}
+	if (!RenameFile(tmpFile, indexFile))
+		throw MyException("Cannot replace catalog index!");
+}
+
+int BuildCatalog(const std::wstring& libraryDir, const std::wstring& indexFile, int nThreads, std::ostream& log)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	vector<wstring> files;
+	ListFiles(libraryDir, L".txt", true, files);
+
+	//reuse rows of unchanged fumens. an index of an older version is rebuilt from scratch
+	map<string, CatalogRecord> oldRecords;
+	try {
+		CatalogView old;
+		if (old.Open(indexFile)) {
+			for (size_t i = 0, n = old.GetCount(); i < n; ++i) {
+				CatalogRecord r;
+				old.GetRecord(i, r);
+				oldRecords[r.path] = r;
+			}
+		}
+	} catch (MyException&) {
+		oldRecords.clear();
+	}
+
+	//the mtime only has seconds and copies keep it, so a row is reused when size and content crc match
+	vector<CatalogRecord> records(files.size());
+	vector<char> valid(files.size(), 0);
+	atomic<size_t> next(0);
+	atomic<int> nParsed(0);
+	mutex logMutex;
+	vector<thread> workers;
+	for (int n = 0; n < max(nThreads, 1); ++n) {
+		workers.push_back(thread([&]() {
+			string bytes;
+			for (size_t i; (i = next++) < files.size(); ) {
+				CatalogRecord& r = records[i];
+				r.path = ToUtf8(files[i]);
+				try {
+					if (!ReadFileBytes(files[i], bytes))
+						throw MyException("Cannot open input file!");
+
+					boost::crc_32_type crc;
+					crc.process_bytes(bytes.data(), bytes.size());
+
+					auto old = oldRecords.find(r.path);
+					if (old != oldRecords.end() && old->second.size == static_cast<std::int64_t>(bytes.size()) && old->second.crc == crc.checksum()) {
+						r = old->second;
+					} else {
+						FumenTimeline t;
+						ParseFumenBytes(bytes, t);
+						MakeCatalogRecord(t, r);
+						++nParsed;
+					}
+					r.mtime = GetFileMTime(files[i]);
+					r.size = bytes.size();
+					r.crc = crc.checksum();
+					valid[i] = 1;
+				} catch (exception& e) {
+					lock_guard<mutex> lock(logMutex);
+					log << r.path << ": " << e.what() << endl;
+				}
+			}
+		}));
+	}
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+
+	vector<CatalogRecord> result;
+	for (size_t i = 0; i < records.size(); ++i)
+		if (valid[i])
+			result.push_back(records[i]);
+
+	SaveCatalog(result, indexFile);
+	return nParsed;
+}
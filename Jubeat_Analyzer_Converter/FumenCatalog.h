@@ -0,0 +1,81 @@
+#pragma once
+
+#include "FumenTimeline.h"
+#include "FileUtil.h"
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+struct CatalogRecord {
+	std::string path; //utf-8
+	std::string musicFile; //utf-8
+	std::int64_t mtime;
+	std::int64_t size; //bytes of the file
+	std::uint32_t crc; //crc32 of the file
+	double minTempo;
+	double maxTempo;
+	int keys;
+	int bars;
+	float length; //seconds
+	float avgDensity; //keys per second
+	float peakDensity; //most keys within any one second
+};
+
+void MakeCatalogRecord(const FumenTimeline& t, CatalogRecord& r);
+
+//range filters are inclusive, the defaults let everything pass
+struct CatalogFilter {
+	double minTempo, maxTempo;
+	int minKeys, maxKeys;
+	double minLength, maxLength;
+	double minDensity, maxDensity;
+	std::string music; //substring of the music file, utf-8
+
+	CatalogFilter();
+};
+
+//read-only view of a catalog index through a memory mapping.
+//the file holds one column per field, rows sorted by max tempo, then a utf-8 string pool:
+//  "JACATLG2" count stringsSize
+//  int64 mtime[], int64 size[], double minTempo[], double maxTempo[], uint32 crc[], int32 keys[], int32 bars[],
+//  float length[], float avgDensity[], float peakDensity[], uint32 pathOffset[], uint32 musicOffset[],
+//  strings
+class CatalogView : boost::noncopyable {
+		MappedFile _file;
+		std::uint32_t _count;
+		const std::int64_t* _mtime;
+		const std::int64_t* _size;
+		const double* _minTempo;
+		const double* _maxTempo;
+		const std::uint32_t* _crc;
+		const std::int32_t* _keys;
+		const std::int32_t* _bars;
+		const float* _length;
+		const float* _avgDensity;
+		const float* _peakDensity;
+		const std::uint32_t* _pathOffset;
+		const std::uint32_t* _musicOffset;
+		const char* _strings;
+	public:
+		CatalogView();
+
+		//false if the index does not exist, throws if it is broken
+		bool Open(const std::wstring& indexFile);
+		void Close();
+
+		std::size_t GetCount() const;
+		void GetRecord(std::size_t i, CatalogRecord& r) const;
+
+		//row indices matching the filter, in max tempo order
+		void Query(const CatalogFilter& f, std::vector<std::size_t>& rows) const;
+};
+
+void SaveCatalog(std::vector<CatalogRecord>& records, const std::wstring& indexFile);
+
+//build the index of every .txt under libraryDir on nThreads threads.
+//every file is read, but fumens whose size and crc equal the ones in an existing index are not parsed again.
+//returns the number of fumens parsed
+int BuildCatalog(const std::wstring& libraryDir, const std::wstring& indexFile, int nThreads, std::ostream& log);
@@ -0,0 +1,282 @@
+#include "FumenDiff.h"
+#include "FumenFingerprint.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+struct HashEntry {
+	int oldCount;
+	int newCount;
+	int oldIndex;
+
+	HashEntry() : oldCount(0), newCount(0), oldIndex(-1) {}
+};
+
+struct BarNote {
+	std::int64_t pos; //on the same 1/192 beat grid as the bar hashes
+	int panel;
+	double num;
+	double time;
+
+	bool operator < (const BarNote& n) const
+	{
+		return pos != n.pos ? pos < n.pos : panel < n.panel;
+	}
+};
+
+void GetBarNotes(const FumenTimeline& t, int shousetsu, std::vector<BarNote>& notes)
+{
+	notes.clear();
+	if (shousetsu < 0)
+		return;
+
+	const TimelineShousetsu& s = t.GetShousetsus()[shousetsu];
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+	for (int i = s.firstHaku, ie = s.firstHaku + s.hakuCount; i < ie; ++i) {
+		for (int p = 0; p < 16; ++p) {
+			if (hakus[i].keys & (1 << p)) {
+				BarNote n;
+				n.pos = static_cast<std::int64_t>(std::floor(hakus[i].num * 192 + 0.5));
+				n.panel = p + 1;
+				n.num = hakus[i].num;
+				n.time = hakus[i].time;
+				notes.push_back(n);
+			}
+		}
+	}
+	std::sort(notes.begin(), notes.end());
+}
+
+void AddNoteDiff(std::vector<NoteDiff>& notes, bool inserted, int shousetsu, const BarNote& n)
+{
+	NoteDiff d;
+	d.inserted = inserted;
+	d.shousetsu = shousetsu;
+	d.num = n.num;
+	d.time = n.time;
+	d.panel = n.panel;
+	notes.push_back(d);
+}
+
+void AddBarDiff(std::vector<BarDiff>& diffs, int type, int oldShousetsu, int newShousetsu)
+{
+	BarDiff d;
+	d.type = type;
+	d.oldShousetsu = oldShousetsu;
+	d.newShousetsu = newShousetsu;
+	diffs.push_back(d);
+}
+
+//gaps between anchors whose edit script is longer than this are left to the bar by bar pairing
+const int MaxGapEdits = 256;
+
+void Link(std::vector<int>& oldLink, std::vector<int>& newLink, int i, int j)
+{
+	oldLink[i] = j;
+	newLink[j] = i;
+}
+
+//Myers' greedy diff between two anchors, O((N + M) * D) with D capped at MaxGapEdits
+void LinkGap(const std::vector<std::uint64_t>& oldHashes, const std::vector<std::uint64_t>& newHashes,
+	int i0, int i1, int j0, int j1, std::vector<int>& oldLink, std::vector<int>& newLink)
+{
+	int n = i1 - i0, m = j1 - j0;
+	if (n == 0 || m == 0)
+		return;
+
+	int maxD = std::min(n + m, MaxGapEdits);
+	int offset = maxD + 1;
+	std::vector<int> v(2 * maxD + 3, 0);
+	std::vector< std::vector<int> > trace;
+
+	for (int d = 0; d <= maxD; ++d) {
+		trace.push_back(v);
+		for (int k = -d; k <= d; k += 2) {
+			int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ? v[offset + k + 1] : v[offset + k - 1] + 1;
+			int y = x - k;
+			while (x < n && y < m && oldHashes[i0 + x] == newHashes[j0 + y])
+				++x, ++y;
+			v[offset + k] = x;
+			if (x < n || y < m)
+				continue;
+
+			//walk the snakes back to the start and link their diagonals
+			for (int e = d; e > 0; --e) {
+				const std::vector<int>& pv = trace[e];
+				int kk = x - y;
+				int prevK = (kk == -e || (kk != e && pv[offset + kk - 1] < pv[offset + kk + 1])) ? kk + 1 : kk - 1;
+				int prevX = pv[offset + prevK], prevY = prevX - prevK;
+				while (x > prevX && y > prevY) {
+					--x, --y;
+					Link(oldLink, newLink, i0 + x, j0 + y);
+				}
+				x = prevX;
+				y = prevY;
+			}
+			while (x > 0 && y > 0) {
+				--x, --y;
+				Link(oldLink, newLink, i0 + x, j0 + y);
+			}
+			return;
+		}
+	}
+}
+
+}
+
+void AlignShousetsus(const std::vector<std::uint64_t>& oldHashes, const std::vector<std::uint64_t>& newHashes, std::vector<BarDiff>& diffs)
+{
+	int n = oldHashes.size(), m = newHashes.size();
+	std::vector<int> oldLink(n, -1), newLink(m, -1);
+
+	//common head and tail stand in for the begin and end sentinels
+	int head = 0;
+	for (; head < n && head < m && oldHashes[head] == newHashes[head]; ++head)
+		Link(oldLink, newLink, head, head);
+	for (int i = n - 1, j = m - 1; i >= head && j >= head && oldHashes[i] == newHashes[j]; --i, --j)
+		Link(oldLink, newLink, i, j);
+
+	//bars that occur exactly once on each side
+	std::unordered_map<std::uint64_t, HashEntry> table;
+	table.reserve(n + m);
+	for (int i = 0; i < n; ++i) {
+		HashEntry& e = table[oldHashes[i]];
+		++e.oldCount;
+		e.oldIndex = i;
+	}
+	for (int j = 0; j < m; ++j)
+		++table[newHashes[j]].newCount;
+	for (int j = 0; j < m; ++j) {
+		const HashEntry& e = table[newHashes[j]];
+		if (e.oldCount == 1 && e.newCount == 1 && newLink[j] < 0 && oldLink[e.oldIndex] < 0)
+			Link(oldLink, newLink, e.oldIndex, j);
+	}
+
+	//grow the anchors over equal neighbours, forward then backward
+	for (int i = 0; i + 1 < n; ++i) {
+		int j = oldLink[i] + 1;
+		if (oldLink[i] >= 0 && j < m && oldLink[i + 1] < 0 && newLink[j] < 0 && oldHashes[i + 1] == newHashes[j])
+			Link(oldLink, newLink, i + 1, j);
+	}
+	for (int i = n - 1; i > 0; --i) {
+		int j = oldLink[i] - 1;
+		if (oldLink[i] > 0 && oldLink[i - 1] < 0 && newLink[j] < 0 && oldHashes[i - 1] == newHashes[j])
+			Link(oldLink, newLink, i - 1, j);
+	}
+
+	//where links cross, the bar that moved farther is unlinked and reported as removed here and inserted there
+	for (int i = 0, j = 0; i < n && j < m; ) {
+		if (oldLink[i] == j) {
+			++i, ++j;
+		} else if (oldLink[i] < 0 || oldLink[i] < j) {
+			if (oldLink[i] >= 0) {
+				newLink[oldLink[i]] = -1;
+				oldLink[i] = -1;
+			}
+			++i;
+		} else if (newLink[j] < 0 || newLink[j] < i) {
+			if (newLink[j] >= 0) {
+				oldLink[newLink[j]] = -1;
+				newLink[j] = -1;
+			}
+			++j;
+		} else if (oldLink[i] - j > newLink[j] - i) {
+			newLink[oldLink[i]] = -1;
+			oldLink[i] = -1;
+			++i;
+		} else {
+			oldLink[newLink[j]] = -1;
+			newLink[j] = -1;
+			++j;
+		}
+	}
+
+	//repeated bars never anchor, so runs of them between anchors are aligned by edit distance
+	for (int i = 0, prevI = 0, prevJ = 0; i <= n; ++i) {
+		if (i == n || oldLink[i] >= 0) {
+			int j = i == n ? m : oldLink[i];
+			LinkGap(oldHashes, newHashes, prevI, i, prevJ, j, oldLink, newLink);
+			prevI = i + 1;
+			prevJ = j + 1;
+		}
+	}
+
+	diffs.clear();
+	int i = 0, j = 0;
+	while (i < n || j < m) {
+		if (i < n && j < m && oldLink[i] == j)
+			AddBarDiff(diffs, BarDiff::BARDIFF_EQUAL, i++, j++);
+		else if (i < n && j < m && oldLink[i] < 0 && newLink[j] < 0)
+			AddBarDiff(diffs, BarDiff::BARDIFF_CHANGED, i++, j++);
+		else if (i < n && oldLink[i] < 0)
+			AddBarDiff(diffs, BarDiff::BARDIFF_REMOVED, i++, -1);
+		else
+			AddBarDiff(diffs, BarDiff::BARDIFF_INSERTED, -1, j++);
+	}
+}
+
+void DiffShousetsuNotes(const FumenTimeline& oldT, int oldShousetsu, const FumenTimeline& newT, int newShousetsu, std::vector<NoteDiff>& notes)
+{
+	std::vector<BarNote> oldNotes, newNotes;
+	GetBarNotes(oldT, oldShousetsu, oldNotes);
+	GetBarNotes(newT, newShousetsu, newNotes);
+
+	notes.clear();
+	auto o = oldNotes.cbegin(), oe = oldNotes.cend();
+	auto n = newNotes.cbegin(), ne = newNotes.cend();
+	while (o != oe || n != ne) {
+		if (n == ne || (o != oe && *o < *n))
+			AddNoteDiff(notes, false, oldShousetsu, *o++);
+		else if (o == oe || *n < *o)
+			AddNoteDiff(notes, true, newShousetsu, *n++);
+		else
+			++o, ++n;
+	}
+}
+
+void PrintFumenDiff(const FumenTimeline& oldT, const FumenTimeline& newT, std::ostream& out)
+{
+	std::vector<std::uint64_t> oldHashes, newHashes;
+	GetShousetsuHashes(oldT, oldHashes);
+	GetShousetsuHashes(newT, newHashes);
+
+	std::vector<BarDiff> diffs;
+	AlignShousetsus(oldHashes, newHashes, diffs);
+
+	int counts[BarDiff::BARDIFF_INSERTED + 1] = { 0 };
+	int notesInserted = 0, notesRemoved = 0;
+	std::vector<NoteDiff> notes;
+	for (auto d = diffs.cbegin(), de = diffs.cend(); d != de; ++d) {
+		++counts[d->type];
+		if (d->type == BarDiff::BARDIFF_EQUAL)
+			continue;
+
+		if (d->type == BarDiff::BARDIFF_CHANGED) {
+			const TimelineShousetsu& os = oldT.GetShousetsus()[d->oldShousetsu];
+			const TimelineShousetsu& ns = newT.GetShousetsus()[d->newShousetsu];
+			out << "~ bar " << d->oldShousetsu + 1 << " -> " << d->newShousetsu + 1;
+			if (os.tempo != ns.tempo)
+				out << ", tempo " << os.tempo << " -> " << ns.tempo;
+			if (os.beat != ns.beat)
+				out << ", beats " << os.beat << " -> " << ns.beat;
+			out << std::endl;
+		} else if (d->type == BarDiff::BARDIFF_REMOVED)
+			out << "- bar " << d->oldShousetsu + 1 << std::endl;
+		else
+			out << "+ bar " << d->newShousetsu + 1 << std::endl;
+
+		DiffShousetsuNotes(oldT, d->oldShousetsu, newT, d->newShousetsu, notes);
+		for (auto i = notes.cbegin(), e = notes.cend(); i != e; ++i) {
+			out << '\t' << (i->inserted ? '+' : '-') << ' ' << i->time << "s\tbeat " << i->num
+				<< "\tpanel " << i->panel << std::endl;
+			++(i->inserted ? notesInserted : notesRemoved);
+		}
+	}
+
+	out << "bars: " << counts[BarDiff::BARDIFF_EQUAL] << " equal, " << counts[BarDiff::BARDIFF_CHANGED] << " changed, "
+		<< counts[BarDiff::BARDIFF_REMOVED] << " removed, " << counts[BarDiff::BARDIFF_INSERTED] << " inserted; notes: +"
+		<< notesInserted << " -" << notesRemoved << std::endl;
+}
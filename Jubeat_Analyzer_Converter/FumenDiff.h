@@ -0,0 +1,35 @@
+#pragma once
+
+#include "FumenTimeline.h"
+
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+//one bar of the alignment. a side that has no bar is -1
+struct BarDiff {
+	enum { BARDIFF_EQUAL = 1, BARDIFF_CHANGED, BARDIFF_REMOVED, BARDIFF_INSERTED };
+	int type;
+	int oldShousetsu;
+	int newShousetsu;
+};
+
+//align two bar hash sequences in linear time (Heckel's algorithm).
+//bars whose hash is unique in both sequences anchor the alignment, which then grows to equal neighbours.
+//the runs of repeated bars left between anchors are aligned by Myers' diff, with the edit count capped.
+//bars moved across an anchor come out as removed and inserted
+void AlignShousetsus(const std::vector<std::uint64_t>& oldHashes, const std::vector<std::uint64_t>& newHashes, std::vector<BarDiff>& diffs);
+
+struct NoteDiff {
+	bool inserted; //false for removed
+	int shousetsu; //in the version the note belongs to
+	double num;
+	double time; //seconds at speed 1
+	int panel; //1-16
+};
+
+//notes of a bar pair that are only on one side, in time order. either bar may be -1
+void DiffShousetsuNotes(const FumenTimeline& oldT, int oldShousetsu, const FumenTimeline& newT, int newShousetsu, std::vector<NoteDiff>& notes);
+
+//print every bar that is not equal with its notes, and a summary line
+void PrintFumenDiff(const FumenTimeline& oldT, const FumenTimeline& newT, std::ostream& out);
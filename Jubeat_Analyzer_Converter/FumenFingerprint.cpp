@@ -0,0 +1,259 @@
+#include "FumenFingerprint.h"
+#include "FumenLoader.h"
+#include "MyException.h"
+
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+//haku positions are compared on a 1/192 beat grid
+static const double PositionGrid = 192;
+
+static std::uint64_t Mix64(std::uint64_t x)
+{
+	//splitmix64 finalizer
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static std::uint64_t Combine(std::uint64_t h, std::uint64_t v)
+{
+	return Mix64(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+static std::int64_t Quantize(double v, double grid)
+{
+	return static_cast<std::int64_t>(std::floor(v * grid + 0.5));
+}
+
+std::uint64_t HashShousetsu(const FumenTimeline& t, int shousetsu)
+{
+	const TimelineShousetsu& s = t.GetShousetsus()[shousetsu];
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+
+	std::uint64_t h = Combine(0, Quantize(s.tempo, 1000));
+	h = Combine(h, Quantize(s.beat, PositionGrid));
+
+	//hakus are sorted by position, glyphs sharing a position are merged
+	int i = s.firstHaku, ie = s.firstHaku + s.hakuCount;
+	while (i < ie) {
+		std::int64_t pos = Quantize(hakus[i].num, PositionGrid);
+		std::uint16_t keys = 0;
+		for (; i < ie && Quantize(hakus[i].num, PositionGrid) == pos; ++i)
+			keys |= hakus[i].keys;
+
+		h = Combine(h, pos);
+		h = Combine(h, keys);
+	}
+	return h;
+}
+
+void GetShousetsuHashes(const FumenTimeline& t, std::vector<std::uint64_t>& hashes)
+{
+	int n = t.GetShousetsus().size();
+	hashes.resize(n);
+	for (int i = 0; i < n; ++i)
+		hashes[i] = HashShousetsu(t, i);
+}
+
+void MakeFingerprint(const FumenTimeline& t, FumenFingerprint& f)
+{
+	const std::vector<TimelineShousetsu>& shousetsus = t.GetShousetsus();
+
+	std::vector<std::uint64_t> hashes;
+	GetShousetsuHashes(t, hashes);
+
+	//leading and trailing empty bars are only an offset
+	int first = 0, last = hashes.size();
+	while (first < last && shousetsus[first].hakuCount == 0)
+		++first;
+	while (last > first && shousetsus[last - 1].hakuCount == 0)
+		--last;
+
+	f.hash = 0;
+	for (int i = first; i < last; ++i)
+		f.hash = Combine(f.hash, hashes[i]);
+
+	std::uint64_t seeds[MinHashSize];
+	for (int k = 0; k < MinHashSize; ++k) {
+		seeds[k] = Mix64(k + 1);
+		f.minHash[k] = 0xffffffff;
+	}
+
+	int nShingles = last - first >= ShingleBars ? last - first - ShingleBars + 1 : (last > first ? 1 : 0);
+	for (int i = 0; i < nShingles; ++i) {
+		std::uint64_t shingle = 0;
+		for (int j = first + i, je = std::min(first + i + ShingleBars, last); j < je; ++j)
+			shingle = Combine(shingle, hashes[j]);
+
+		for (int k = 0; k < MinHashSize; ++k) {
+			std::uint32_t v = static_cast<std::uint32_t>(Mix64(shingle ^ seeds[k]));
+			if (v < f.minHash[k])
+				f.minHash[k] = v;
+		}
+	}
+}
+
+double EstimateSimilarity(const FumenFingerprint& a, const FumenFingerprint& b)
+{
+	int same = 0;
+	for (int k = 0; k < MinHashSize; ++k)
+		if (a.minHash[k] == b.minHash[k])
+			++same;
+	return static_cast<double>(same) / MinHashSize;
+}
+
+static std::size_t FindRoot(std::vector<std::size_t>& parent, std::size_t i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void Unite(std::vector<std::size_t>& parent, std::size_t a, std::size_t b)
+{
+	a = FindRoot(parent, a);
+	b = FindRoot(parent, b);
+	if (a != b)
+		parent[std::max(a, b)] = std::min(a, b);
+}
+
+void ClusterFingerprints(const std::vector<FumenFingerprint>& fps, double threshold, std::vector< std::vector<std::size_t> >& clusters)
+{
+	std::size_t n = fps.size();
+	std::vector<std::size_t> parent(n);
+	for (std::size_t i = 0; i < n; ++i)
+		parent[i] = i;
+
+	//exact duplicates, only the first of each goes on to the band buckets
+	std::vector<char> first(n, 0);
+	{
+		std::unordered_map<std::uint64_t, std::size_t> firstOf;
+		for (std::size_t i = 0; i < n; ++i) {
+			auto r = firstOf.insert(std::make_pair(fps[i].hash, i));
+			if (r.second)
+				first[i] = 1;
+			else
+				Unite(parent, r.first->second, i);
+		}
+	}
+
+	//near duplicates: a fumen is checked against every fumen already in a bucket it falls into,
+	//near duplicates of each other may both be far from whichever came first
+	const int rows = MinHashSize / MinHashBands;
+	for (int b = 0; b < MinHashBands; ++b) {
+		std::unordered_map<std::uint64_t, std::vector<std::size_t> > bucket;
+		for (std::size_t i = 0; i < n; ++i) {
+			if (!first[i])
+				continue;
+
+			std::uint64_t h = b;
+			for (int r = 0; r < rows; ++r)
+				h = Combine(h, fps[i].minHash[b * rows + r]);
+
+			std::vector<std::size_t>& members = bucket[h];
+			for (auto m = members.cbegin(), e = members.cend(); m != e; ++m) {
+				if (FindRoot(parent, *m) != FindRoot(parent, i) && EstimateSimilarity(fps[*m], fps[i]) >= threshold)
+					Unite(parent, *m, i);
+			}
+			members.push_back(i);
+		}
+	}
+
+	std::unordered_map<std::size_t, std::size_t> clusterOf;
+	clusters.clear();
+	std::vector< std::vector<std::size_t> > all;
+	for (std::size_t i = 0; i < n; ++i) {
+		std::size_t root = FindRoot(parent, i);
+		auto r = clusterOf.insert(std::make_pair(root, all.size()));
+		if (r.second)
+			all.push_back(std::vector<std::size_t>());
+		all[r.first->second].push_back(i);
+	}
+
+	for (auto i = all.begin(), e = all.end(); i != e; ++i)
+		if (i->size() >= 2)
+			clusters.push_back(std::move(*i));
+}
+
+void FindDuplicateFumens(const std::vector<std::wstring>& files, double threshold, int nThreads, std::ostream& out, std::ostream& log)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	vector<FumenFingerprint> fps(files.size());
+	vector<char> valid(files.size(), 0);
+
+	atomic<size_t> next(0);
+	mutex logMutex;
+	vector<thread> workers;
+	for (int n = 0; n < max(nThreads, 1); ++n) {
+		workers.push_back(thread([&]() {
+			for (size_t i; (i = next++) < files.size(); ) {
+				try {
+					string bytes;
+					if (!ReadFileBytes(files[i], bytes))
+						throw MyException("Cannot open input file!");
+
+					FumenTimeline t;
+					ParseFumenBytes(bytes, t);
+					MakeFingerprint(t, fps[i]);
+					valid[i] = 1;
+				} catch (exception& e) {
+					lock_guard<mutex> lock(logMutex);
+					log << ToUtf8(files[i]) << ": " << e.what() << endl;
+				}
+			}
+		}));
+	}
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+
+	vector<size_t> index;
+	vector<FumenFingerprint> validFps;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (valid[i]) {
+			index.push_back(i);
+			validFps.push_back(fps[i]);
+		}
+	}
+
+	vector< vector<size_t> > clusters;
+	ClusterFingerprints(validFps, threshold, clusters);
+
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		vector<size_t>& members = clusters[c];
+
+		//the largest group of identical timelines leads, the others are compared against it
+		unordered_map<uint64_t, int> copies;
+		for (auto i = members.cbegin(), e = members.cend(); i != e; ++i)
+			++copies[validFps[*i].hash];
+		stable_sort(members.begin(), members.end(), [&](size_t a, size_t b) -> bool {
+			int ca = copies[validFps[a].hash], cb = copies[validFps[b].hash];
+			if (ca != cb) return ca > cb;
+			return validFps[a].hash < validFps[b].hash;
+		});
+		const FumenFingerprint& head = validFps[members[0]];
+
+		out << "cluster " << c + 1 << ":" << endl;
+		for (auto i = members.cbegin(), e = members.cend(); i != e; ++i) {
+			const FumenFingerprint& fp = validFps[*i];
+			out << '\t';
+			if (fp.hash == head.hash)
+				out << "same";
+			else
+				out << EstimateSimilarity(head, fp);
+			out << '\t' << ToUtf8(files[index[*i]]) << endl;
+		}
+	}
+}
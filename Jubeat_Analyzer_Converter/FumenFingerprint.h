@@ -0,0 +1,34 @@
+#pragma once
+
+#include "FumenTimeline.h"
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+//hash of one bar: tempo, beats and every (haku position, keys) pair.
+//layout, glyphs, comments and offset do not change it
+std::uint64_t HashShousetsu(const FumenTimeline& t, int shousetsu);
+void GetShousetsuHashes(const FumenTimeline& t, std::vector<std::uint64_t>& hashes);
+
+const int MinHashSize = 64;
+const int MinHashBands = 16; //MinHashSize / MinHashBands rows per band
+const int ShingleBars = 2;
+
+struct FumenFingerprint {
+	std::uint64_t hash; //whole timeline without leading and trailing empty bars
+	std::uint32_t minHash[MinHashSize]; //over ShingleBars-grams of bar hashes
+};
+
+void MakeFingerprint(const FumenTimeline& t, FumenFingerprint& f);
+
+//estimated jaccard similarity of the bar n-gram sets
+double EstimateSimilarity(const FumenFingerprint& a, const FumenFingerprint& b);
+
+//groups of two or more fingerprints that are identical or estimated at least threshold similar.
+//candidates come from locality-sensitive hashing of the min hash bands, so the cost is close to linear
+void ClusterFingerprints(const std::vector<FumenFingerprint>& fps, double threshold, std::vector< std::vector<std::size_t> >& clusters);
+
+//fingerprint files on nThreads threads and print the clusters
+void FindDuplicateFumens(const std::vector<std::wstring>& files, double threshold, int nThreads, std::ostream& out, std::ostream& log);
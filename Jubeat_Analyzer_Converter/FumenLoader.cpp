@@ -0,0 +1,121 @@
+#include "FumenLoader.h"
+#include "FumenReader.h"
+#include "FumenTimeline.h"
+
+#include <regex>
+#include <codecvt>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+const std::locale& GetJapaneseLocale()
+{
+	static std::locale jpLoc("japanese", std::locale::ctype);
+	return jpLoc;
+}
+
+const std::locale& GetDefaultLocale()
+{
+	static std::locale defLoc("", std::locale::ctype);
+	return defLoc;
+}
+
+const std::locale& GetUtf8Locale()
+{
+	static std::locale utf8Loc(GetDefaultLocale(), new std::codecvt_utf8<wchar_t>());
+	return utf8Loc;
+}
+
+void ReadFumenLines(std::istream& s, std::vector<std::wstring>& lines)
+{
+	using namespace std;
+
+	const locale& jpLoc = GetJapaneseLocale();
+	const locale& defLoc = GetDefaultLocale();
+
+	while(!s.eof()) {
+		string line;
+		getline(s, line);
+
+		//fumen bytes are read in binary mode, drop what text mode would have
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+
+		if (line.length() > 3 && line[0] == 'm')
+			lines.push_back(EncodingConv(line, defLoc));
+		else
+			lines.push_back(EncodingConv(line, jpLoc));
+	}
+}
+
+std::wstring GetFumenName(const std::wstring& outputFileName)
+{
+	using namespace std;
+
+	static const wregex fnReg(L"([^\\\\]*?\\\\)?(.+?)\\.[Tt][Xx][Tt]");
+
+	wsmatch fnMatch;
+	if (regex_match(outputFileName, fnMatch, fnReg))
+		return fnMatch[2].str();
+	else
+		return outputFileName;
+}
+
+bool ReadFileBytes(const std::wstring& fileName, std::string& bytes)
+{
+	std::fstream fs(fileName.c_str(), std::ios::in | std::ios::binary);
+	if (!fs)
+		return false;
+
+	bytes.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+	return true;
+}
+
+void ParseFumenBytes(const std::string& bytes, FumenParser& parser)
+{
+	std::istringstream s(bytes);
+	std::vector<std::wstring> lines;
+	ReadFumenLines(s, lines);
+	parser.LoadString(lines);
+}
+
+std::string ToUtf8(const std::wstring& s)
+{
+	std::wstring_convert< std::codecvt_utf8<wchar_t> > conv;
+	return conv.to_bytes(s);
+}
+
+std::wstring FromUtf8(const std::string& s)
+{
+	std::wstring_convert< std::codecvt_utf8<wchar_t> > conv;
+	return conv.from_bytes(s);
+}
+
+void WarmUpStatics()
+{
+	GetJapaneseLocale();
+	GetDefaultLocale();
+	GetUtf8Locale();
+	GetFumenName(L"warmup.txt");
+
+	//one bar in each layout, enough to reach every regex of the parser
+	const wchar_t* oneColumn[] = {
+		L"t=120", L"b=4", L"r=0", L"o=0", L"m=\"warmup.ogg\"", L"*\u2460:0",
+		L"\u2460\u25a1\u25a1\u25a1", L"\u25a1\u25a1\u25a1\u25a1", L"\u25a1\u25a1\u25a1\u25a1", L"\u25a1\u25a1\u25a1\u25a1",
+		L"--"
+	};
+	const wchar_t* twoColumn[] = {
+		L"t=120",
+		L"\u2460\u25a1\u25a1\u25a1 |\u2460\uff0d\uff0d\uff0d|", L"\u25a1\u25a1\u25a1\u25a1 |\uff0d\uff0d\uff0d\uff0d|",
+		L"\u25a1\u25a1\u25a1\u25a1 |\uff0d\uff0d\uff0d\uff0d|", L"\u25a1\u25a1\u25a1\u25a1 |\uff0d\uff0d\uff0d\uff0d|",
+		L"1"
+	};
+
+	FumenTimeline t1;
+	std::vector<std::wstring> lines(oneColumn, oneColumn + sizeof(oneColumn) / sizeof(oneColumn[0]));
+	t1.LoadString(lines);
+
+	FumenTimeline t2;
+	lines.assign(twoColumn, twoColumn + sizeof(twoColumn) / sizeof(twoColumn[0]));
+	t2.LoadString(lines);
+}
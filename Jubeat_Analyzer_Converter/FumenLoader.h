@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <istream>
+#include <locale>
+
+class FumenParser;
+
+//locales used for decoding fumen files and encoding outputs
+//function-local statics, call them once before starting worker threads
+const std::locale& GetJapaneseLocale();
+const std::locale& GetDefaultLocale();
+const std::locale& GetUtf8Locale();
+
+//read all lines of a fumen file. music file lines are in the default encoding, others in shift-jis
+void ReadFumenLines(std::istream& s, std::vector<std::wstring>& lines);
+
+//the fumen name written into yubiosi file, which is the output filename without path and .txt
+std::wstring GetFumenName(const std::wstring& outputFileName);
+
+//whole file content, returns false if the file cannot be opened
+bool ReadFileBytes(const std::wstring& fileName, std::string& bytes);
+
+//parse fumen file content held in memory
+void ParseFumenBytes(const std::string& bytes, FumenParser& parser);
+
+std::string ToUtf8(const std::wstring& s);
+std::wstring FromUtf8(const std::string& s);
+
+//construct locales and compile every static regex of the parser,
+//must be called before parsing on more than one thread
+void WarmUpStatics();
@@ -0,0 +1,289 @@
+#include "FumenPlayer.h"
+#include "MyException.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <boost/any.hpp>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+#ifdef _WIN32
+
+static double GetCounterPeriod()
+{
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	return 1.0 / f.QuadPart;
+}
+
+//the frequency is fixed at boot, read it once before main
+static const double CounterPeriod = GetCounterPeriod();
+
+double GetPreciseTime()
+{
+	LARGE_INTEGER c;
+	QueryPerformanceCounter(&c);
+	return c.QuadPart * CounterPeriod;
+}
+
+#else
+
+double GetPreciseTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
+
+void GetPlaybackEvents(const FumenTimeline& t, std::vector<PlaybackEvent>& events)
+{
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+	const std::vector<TimelineShousetsu>& shousetsus = t.GetShousetsus();
+	const std::vector<TimelineInfo>& infos = t.GetInfos();
+
+	events.clear();
+	events.reserve(hakus.size());
+
+	//offset of each bar as FumenParser_TimeCallback keeps it: its clock starts at 0.1,
+	//r= sets the offset in ms and o= sets it so that the clock reads o= at that point
+	double offset = 0;
+	auto info = infos.cbegin();
+	int shousetsu = -1;
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i) {
+		for (; shousetsu != i->shousetsu; ++shousetsu) {
+			for (; info != infos.cend() && info->shousetsu <= shousetsu + 1; ++info) {
+				if (info->info.type == FumenInfo::INFOTYPE_OFFSETR)
+					offset = boost::any_cast<double>(info->info.value);
+				else if (info->info.type == FumenInfo::INFOTYPE_OFFSETO)
+					offset = boost::any_cast<double>(info->info.value) - (0.1 + shousetsus[info->shousetsu].time) * 1000;
+			}
+		}
+
+		if (i->keys == 0)
+			continue;
+
+		PlaybackEvent pe;
+		pe.time = i->time + 0.1 + offset / 1000;
+		pe.keys = i->keys;
+		pe.shousetsu = i->shousetsu;
+		pe.newShousetsu = false;
+		events.push_back(pe);
+	}
+
+	//positions at or past the beat count of their bar come after the next bar's first haku
+	std::stable_sort(events.begin(), events.end(), [](const PlaybackEvent& a, const PlaybackEvent& b) -> bool {
+		return a.time < b.time;
+	});
+
+	//glyphs sharing a time fire together
+	std::vector<bool> started(shousetsus.size(), false);
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < events.size(); ++i) {
+		PlaybackEvent pe = events[i];
+		bool first = !started[pe.shousetsu];
+		started[pe.shousetsu] = true;
+
+		if (n != 0 && events[n - 1].time == pe.time) {
+			events[n - 1].keys |= pe.keys;
+			if (first) {
+				events[n - 1].shousetsu = pe.shousetsu;
+				events[n - 1].newShousetsu = true;
+			}
+			continue;
+		}
+
+		pe.newShousetsu = first;
+		events[n++] = pe;
+	}
+	events.resize(n);
+}
+
+FumenPlayer::FumenPlayer(const FumenTimeline& t, std::size_t ringCapacity)
+	: _ring(ringCapacity), _spinMargin(0.002), _running(false), _playing(false),
+	_anchorSong(0), _anchorWall(0), _rate(1), _next(0), _generation(0), _dropped(0)
+{
+	GetPlaybackEvents(t, _events);
+
+	//a negative offset can put the first notes before the music starts
+	if (!_events.empty())
+		_anchorSong = std::min(_events[0].time, 0.0);
+	_lateness.reserve(_events.size());
+}
+
+FumenPlayer::~FumenPlayer()
+{
+	Stop();
+}
+
+void FumenPlayer::SetSpinMargin(double seconds)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_spinMargin = std::max(seconds, 0.0);
+	++_generation;
+	_changed.notify_one();
+}
+
+void FumenPlayer::Start()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_running)
+		return;
+
+#ifdef _WIN32
+	//sleeps are rounded to the timer period, 15.6ms unless raised
+	timeBeginPeriod(1);
+#endif
+	_running = true;
+	_thread = std::thread([this]() { Run(); });
+}
+
+void FumenPlayer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_running)
+			return;
+		_running = false;
+		++_generation;
+		_changed.notify_one();
+	}
+	_thread.join();
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+double FumenPlayer::GetSongTimeLocked(double now) const
+{
+	return _playing ? _anchorSong + (now - _anchorWall) * _rate : _anchorSong;
+}
+
+void FumenPlayer::Play()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_playing)
+		return;
+	_anchorWall = GetPreciseTime();
+	_playing = true;
+	++_generation;
+	_changed.notify_one();
+}
+
+void FumenPlayer::Pause()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_playing)
+		return;
+	_anchorSong = GetSongTimeLocked(GetPreciseTime());
+	_playing = false;
+	++_generation;
+	_changed.notify_one();
+}
+
+void FumenPlayer::Seek(double songTime)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_anchorSong = songTime;
+	_anchorWall = GetPreciseTime();
+	_next = std::lower_bound(_events.begin(), _events.end(), songTime, [](const PlaybackEvent& e, double t) -> bool {
+		return e.time < t;
+	}) - _events.begin();
+	++_generation;
+	_changed.notify_one();
+}
+
+void FumenPlayer::SetRate(double rate)
+{
+	if (rate <= 0)
+		throw MyException("Speed must be positive!");
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	double now = GetPreciseTime();
+	_anchorSong = GetSongTimeLocked(now);
+	_anchorWall = now;
+	_rate = rate;
+	++_generation;
+	_changed.notify_one();
+}
+
+double FumenPlayer::GetSongTime()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return GetSongTimeLocked(GetPreciseTime());
+}
+
+bool FumenPlayer::IsFinished()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _next >= _events.size();
+}
+
+bool FumenPlayer::Poll(PlaybackDelivery& d)
+{
+	return _ring.TryPop(d);
+}
+
+void FumenPlayer::Run()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (_running) {
+		if (!_playing || _next >= _events.size()) {
+			_changed.wait(lock);
+			continue;
+		}
+
+		const PlaybackEvent& e = _events[_next];
+		double deadline = _anchorWall + (e.time - _anchorSong) / _rate;
+		double now = GetPreciseTime();
+		if (deadline - now > _spinMargin) {
+			//sleep on the condition, so control calls wake the thread and the deadline is recomputed
+			_changed.wait_for(lock, std::chrono::duration<double>(deadline - now - _spinMargin));
+			continue;
+		}
+
+		//spin without the lock, a control call made meanwhile cancels this deadline
+		unsigned generation = _generation;
+		lock.unlock();
+		while ((now = GetPreciseTime()) < deadline)
+			;
+		lock.lock();
+		if (generation != _generation)
+			continue;
+
+		PlaybackDelivery d;
+		d.event = e;
+		d.lateness = now - deadline;
+		if (_ring.TryPush(d))
+			_lateness.push_back(d.lateness);
+		else
+			++_dropped;
+		++_next;
+	}
+}
+
+JitterStats FumenPlayer::GetJitterStats() const
+{
+	JitterStats s;
+	s.fired = _lateness.size();
+	s.dropped = _dropped;
+	s.mean = s.p50 = s.p99 = s.max = 0;
+	if (_lateness.empty())
+		return s;
+
+	std::vector<double> sorted(_lateness);
+	std::sort(sorted.begin(), sorted.end());
+	for (auto i = sorted.cbegin(), e = sorted.cend(); i != e; ++i)
+		s.mean += *i;
+	s.mean /= sorted.size();
+	s.p50 = sorted[sorted.size() / 2];
+	s.p99 = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+	s.max = sorted.back();
+	return s;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "FumenTimeline.h"
+#include "SpscRing.h"
+
+#include <boost/utility.hpp>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+//seconds on a monotonic clock with sub-microsecond resolution.
+//on windows this is QueryPerformanceCounter, since steady_clock of VS2013 only ticks with the system time
+double GetPreciseTime();
+
+//one event per time with keys, sorted by time. times are the ones FumenParser_TimeCallback reports at speed 1,
+//so they include the 0.1s start and the r= and o= offsets of the chart
+struct PlaybackEvent {
+	double time;
+	std::uint16_t keys;
+	int shousetsu;
+	bool newShousetsu; //first event of its bar
+};
+
+void GetPlaybackEvents(const FumenTimeline& t, std::vector<PlaybackEvent>& events);
+
+struct PlaybackDelivery {
+	PlaybackEvent event;
+	double lateness; //seconds between the deadline and the moment the event fired
+};
+
+struct JitterStats {
+	std::size_t fired;
+	std::size_t dropped; //the consumer let the ring fill up
+	double mean, p50, p99, max; //lateness in seconds
+};
+
+//fires the events of a timeline in real time on its own thread.
+//the thread sleeps until shortly before each deadline and spins the rest of the way, then hands the event
+//to the consumer through a lock-free ring. pause, seek and rate changes only move the anchor that maps
+//song time to clock time, the event buffer is never rebuilt
+class FumenPlayer : boost::noncopyable {
+		std::vector<PlaybackEvent> _events;
+		SpscRing<PlaybackDelivery> _ring;
+		double _spinMargin;
+
+		//song time is _anchorSong + (now - _anchorWall) * _rate while playing
+		std::mutex _mutex;
+		std::condition_variable _changed;
+		bool _running;
+		bool _playing;
+		double _anchorSong;
+		double _anchorWall;
+		double _rate;
+		std::size_t _next;
+		unsigned _generation;
+
+		//written by the scheduling thread only
+		std::vector<double> _lateness;
+		std::size_t _dropped;
+
+		std::thread _thread;
+
+		double GetSongTimeLocked(double now) const;
+		void Run();
+	public:
+		FumenPlayer(const FumenTimeline& t, std::size_t ringCapacity = 1024);
+		~FumenPlayer();
+
+		//how long before a deadline the thread stops sleeping and starts spinning, default 2ms
+		void SetSpinMargin(double seconds);
+
+		//start the scheduling thread, paused at song time 0 or at the first event if that is earlier
+		void Start();
+		void Stop();
+
+		void Play();
+		void Pause();
+		//events from songTime on fire next, playing or paused as before
+		void Seek(double songTime);
+		void SetRate(double rate);
+
+		double GetSongTime();
+		//every event up to the end has fired
+		bool IsFinished();
+
+		//consumer side, one thread only
+		bool Poll(PlaybackDelivery& d);
+
+		//valid after Stop
+		JitterStats GetJitterStats() const;
+};
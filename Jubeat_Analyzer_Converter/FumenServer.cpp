@@ -0,0 +1,350 @@
+#include "FumenServer.h"
+#include "FumenLoader.h"
+#include "YubiosiWriter.h"
+#include "BoundedQueue.h"
+#include "MyException.h"
+
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#include <boost/crc.hpp>
+#include <boost/lexical_cast.hpp>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+const wchar_t* const DefaultServerPipeName = L"\\\\.\\pipe\\JubeatAnalyzerConverter";
+
+FumenServer::FumenServer(std::size_t cacheSize)
+	: _cacheSize(cacheSize), _hits(0), _misses(0)
+{
+}
+
+FumenServer::TimelinePtr FumenServer::GetTimeline(const std::string& bytes)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(bytes.data(), bytes.size());
+	CacheKey key(crc.checksum(), bytes.size());
+
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		auto i = _cache.find(key);
+		if (i != _cache.end() && i->second.bytes == bytes) {
+			++_hits;
+			return i->second.timeline;
+		}
+		++_misses;
+	}
+
+	//parse outside the lock, two requests for the same new fumen may both parse it
+	std::shared_ptr<FumenTimeline> t = std::make_shared<FumenTimeline>();
+	ParseFumenBytes(bytes, *t);
+
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	if (_cacheSize != 0) {
+		auto r = _cache.insert(std::make_pair(key, CacheEntry()));
+		if (r.second) {
+			_cacheOrder.push_back(key);
+			if (_cacheOrder.size() > _cacheSize) {
+				_cache.erase(_cacheOrder.front());
+				_cacheOrder.pop_front();
+			}
+		}
+
+		//a colliding fumen takes over the slot, the newer one is more likely to be asked for again
+		if (r.second || r.first->second.bytes != bytes) {
+			r.first->second.bytes = bytes;
+			r.first->second.timeline = t;
+		}
+	}
+	return t;
+}
+
+std::string FumenServer::HandleConvert(const std::string& bytes, const std::vector<std::string>& fields)
+{
+	if (fields.size() < 3)
+		throw MyException("Missing output file!");
+
+	double speed = 1;
+	if (fields.size() > 3)
+		speed = boost::lexical_cast<double>(fields[3]);
+	if (speed <= 0)
+		throw MyException("Speed must be positive!");
+
+	TimelinePtr t = GetTimeline(bytes);
+
+	std::vector<YubiosiVariant> variants;
+	ScaleYubiosiVariants(*t, std::vector<double>(1, speed), variants);
+	SaveYubiosiFile(*t, variants[0], FromUtf8(fields[2]));
+
+	std::ostringstream r;
+	r << "ok\tkeys=" << t->GetKeysCount();
+	return r.str();
+}
+
+std::string FumenServer::HandleAnalyze(const std::string& bytes)
+{
+	TimelinePtr t = GetTimeline(bytes);
+
+	const std::vector<TimelineShousetsu>& shousetsus = t->GetShousetsus();
+	double minTempo = 0, maxTempo = 0;
+	for (auto i = shousetsus.cbegin(), e = shousetsus.cend(); i != e; ++i) {
+		if (i == shousetsus.cbegin() || i->tempo < minTempo) minTempo = i->tempo;
+		if (i == shousetsus.cbegin() || i->tempo > maxTempo) maxTempo = i->tempo;
+	}
+
+	std::ostringstream r;
+	r << "ok";
+	r << "\tbars=" << shousetsus.size();
+	r << "\tkeys=" << t->GetKeysCount();
+	r << "\tlength=" << t->GetLength();
+	r << "\ttempo=" << minTempo << '-' << maxTempo;
+	r << "\tmusic=" << ToUtf8(t->GetMusicFile());
+	return r.str();
+}
+
+std::string FumenServer::HandleRequest(const std::vector<std::string>& fields, const std::string& payload)
+{
+	if (fields.empty())
+		throw MyException("Empty request!");
+
+	const std::string& command = fields[0];
+	if (command == "convert" || command == "analyze") {
+		if (fields.size() < 2)
+			throw MyException("Missing input file!");
+
+		std::string bytes;
+		if (!ReadFileBytes(FromUtf8(fields[1]), bytes))
+			throw MyException("Cannot open input file!");
+
+		if (command == "convert")
+			return HandleConvert(bytes, fields);
+		else
+			return HandleAnalyze(bytes);
+	} else if (command == "inline") {
+		return HandleConvert(payload, fields);
+	} else if (command == "stats") {
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		std::ostringstream r;
+		r << "ok\thits=" << _hits << "\tmisses=" << _misses << "\tcached=" << _cache.size();
+		return r.str();
+	} else
+		throw MyException("Unknown command!");
+}
+
+static void SplitFields(const std::string& line, std::vector<std::string>& fields)
+{
+	fields.clear();
+	std::string::size_type pos = 0, tab;
+	while ((tab = line.find('\t', pos)) != std::string::npos) {
+		fields.push_back(line.substr(pos, tab - pos));
+		pos = tab + 1;
+	}
+	fields.push_back(line.substr(pos));
+}
+
+//fumens are far smaller, anything above this is a broken request
+static const std::size_t MaxInlineBytes = 64 * 1024 * 1024;
+
+static bool ParseInlineSize(const std::string& field, std::size_t& nBytes)
+{
+	if (field.empty() || field.length() > 9)
+		return false;
+
+	nBytes = 0;
+	for (auto i = field.cbegin(), e = field.cend(); i != e; ++i) {
+		if (*i < '0' || *i > '9')
+			return false;
+		nBytes = nBytes * 10 + (*i - '0');
+	}
+	return nBytes <= MaxInlineBytes;
+}
+
+void FumenServer::ServeStream(std::istream& in, std::ostream& out, int nThreads)
+{
+	struct Task {
+		std::string id;
+		std::vector<std::string> fields;
+		std::string payload;
+	};
+
+	WarmUpStatics();
+
+	if (nThreads < 1)
+		nThreads = 1;
+
+	BoundedQueue<Task> tasks(nThreads * 4);
+	std::mutex outMutex;
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < nThreads; ++i) {
+		workers.push_back(std::thread([&]() {
+			Task t;
+			while (tasks.Pop(t)) {
+				std::string response;
+				try {
+					response = HandleRequest(t.fields, t.payload);
+				} catch (std::exception& e) {
+					response = std::string("error\t") + e.what();
+				}
+
+				std::lock_guard<std::mutex> lock(outMutex);
+				out << t.id << '\t' << response << '\n';
+				out.flush();
+			}
+		}));
+	}
+
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+		if (line.empty())
+			continue;
+
+		Task t;
+		SplitFields(line, t.fields);
+		t.id = t.fields[0];
+		t.fields.erase(t.fields.begin());
+
+		if (!t.fields.empty() && t.fields[0] == "quit")
+			break;
+
+		if (!t.fields.empty() && t.fields[0] == "inline") {
+			//without a valid count the content cannot be skipped, so the connection ends here
+			std::size_t nBytes = 0;
+			if (t.fields.size() > 1 && !ParseInlineSize(t.fields[1], nBytes)) {
+				std::lock_guard<std::mutex> lock(outMutex);
+				out << t.id << "\terror\tBad inline byte count!\n";
+				out.flush();
+				break;
+			}
+			t.payload.resize(nBytes);
+			if (nBytes != 0 && !in.read(&t.payload[0], nBytes))
+				break;
+		}
+
+		tasks.Push(std::move(t));
+	}
+
+	tasks.Close();
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+}
+
+#ifdef _WIN32
+
+//stream buffer over a connected pipe handle, so connections reuse the stream framing
+class PipeStreamBuf : public std::streambuf {
+		HANDLE _pipe;
+		char _inBuf[4096];
+		char _outBuf[4096];
+	public:
+		PipeStreamBuf(HANDLE pipe) : _pipe(pipe)
+		{
+			setg(_inBuf, _inBuf, _inBuf);
+			setp(_outBuf, _outBuf + sizeof(_outBuf));
+		}
+
+	protected:
+		int_type underflow()
+		{
+			DWORD nRead = 0;
+			if (!ReadFile(_pipe, _inBuf, sizeof(_inBuf), &nRead, NULL) || nRead == 0)
+				return traits_type::eof();
+			setg(_inBuf, _inBuf, _inBuf + nRead);
+			return traits_type::to_int_type(_inBuf[0]);
+		}
+
+		int_type overflow(int_type c)
+		{
+			if (sync() != 0)
+				return traits_type::eof();
+			if (!traits_type::eq_int_type(c, traits_type::eof())) {
+				*pptr() = traits_type::to_char_type(c);
+				pbump(1);
+			}
+			return traits_type::not_eof(c);
+		}
+
+		int sync()
+		{
+			const char* p = pbase();
+			while (p < pptr()) {
+				DWORD nWritten = 0;
+				if (!WriteFile(_pipe, p, pptr() - p, &nWritten, NULL))
+					return -1;
+				p += nWritten;
+			}
+			setp(_outBuf, _outBuf + sizeof(_outBuf));
+			return 0;
+		}
+};
+
+void FumenServer::ServePipe(const std::wstring& pipeName)
+{
+	WarmUpStatics();
+
+	for (;;) {
+		HANDLE pipe = CreateNamedPipeW(pipeName.c_str(), PIPE_ACCESS_DUPLEX,
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
+			65536, 65536, 0, NULL);
+		if (pipe == INVALID_HANDLE_VALUE)
+			throw MyException("Cannot create named pipe!");
+
+		if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+			CloseHandle(pipe);
+			continue;
+		}
+
+		std::thread([this, pipe]() {
+			{
+				PipeStreamBuf buf(pipe);
+				std::istream in(&buf);
+				std::ostream out(&buf);
+				try {
+					ServeStream(in, out, 1);
+				} catch (std::exception&) {
+					//a broken connection must not take the other connections down
+				}
+			}
+			FlushFileBuffers(pipe);
+			DisconnectNamedPipe(pipe);
+			CloseHandle(pipe);
+		}).detach();
+	}
+}
+
+bool SendServerRequest(const std::wstring& pipeName, const std::string& request, std::string& response)
+{
+	HANDLE pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeW(pipeName.c_str(), 1000))
+		pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (pipe == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool ok = false;
+	{
+		PipeStreamBuf buf(pipe);
+		std::istream in(&buf);
+		std::ostream out(&buf);
+
+		out << "1\t" << request << "\n1\tquit\n";
+		out.flush();
+
+		//a server which closes the connection without answering counts as no server
+		std::string line;
+		if (std::getline(in, line) && line.compare(0, 2, "1\t") == 0) {
+			response = line.substr(2);
+			ok = true;
+		}
+	}
+
+	CloseHandle(pipe);
+	return ok;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "FumenTimeline.h"
+
+#include <boost/utility.hpp>
+#include <memory>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+//conversion service which keeps the parser statics and parsed fumens warm between requests
+//
+//a request is a line of tab separated fields, the first one is an id echoed in the response:
+//  id  convert  input  output  [speed]
+//  id  inline   nbytes output  [speed]    followed by nbytes of fumen file content
+//  id  analyze  input
+//  id  stats
+//  id  quit
+//responses are "id ok ..." or "id error message" in the order requests complete. paths are utf-8
+//an inline byte count which is not a number up to 64MB is answered with an error and ends the connection
+class FumenServer : boost::noncopyable {
+	public:
+		typedef std::shared_ptr<const FumenTimeline> TimelinePtr;
+	private:
+		//crc32 and size of the file content
+		typedef std::pair<std::uint32_t, std::size_t> CacheKey;
+
+		//the content is kept to tell crc collisions apart
+		struct CacheEntry {
+			std::string bytes;
+			TimelinePtr timeline;
+		};
+
+		std::map<CacheKey, CacheEntry> _cache;
+		std::deque<CacheKey> _cacheOrder;
+		std::size_t _cacheSize;
+		std::size_t _hits;
+		std::size_t _misses;
+		std::mutex _cacheMutex;
+
+		TimelinePtr GetTimeline(const std::string& bytes);
+		std::string HandleConvert(const std::string& bytes, const std::vector<std::string>& fields);
+		std::string HandleAnalyze(const std::string& bytes);
+	public:
+		FumenServer(std::size_t cacheSize);
+
+		//handle a request without its id and return the response without id
+		std::string HandleRequest(const std::vector<std::string>& fields, const std::string& payload);
+
+		//serve requests read from a stream on nThreads workers until quit or end of stream
+		void ServeStream(std::istream& in, std::ostream& out, int nThreads);
+
+#ifdef _WIN32
+		//serve every connection of a named pipe on its own thread, never returns
+		void ServePipe(const std::wstring& pipeName);
+#endif
+};
+
+extern const wchar_t* const DefaultServerPipeName;
+
+#ifdef _WIN32
+//send one request to a running server, returns false if no server is listening
+bool SendServerRequest(const std::wstring& pipeName, const std::string& request, std::string& response);
+#endif
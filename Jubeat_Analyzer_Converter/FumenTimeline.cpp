@@ -0,0 +1,114 @@
+#include "FumenTimeline.h"
+#include "MyException.h"
+
+#include <boost/any.hpp>
+
+FumenTimeline::FumenTimeline()
+{
+	Clear();
+}
+
+void FumenTimeline::Clear()
+{
+	_hakus.clear();
+	_shousetsus.clear();
+	_infos.clear();
+	_musicFile.clear();
+
+	_beat = 4;
+	_tempo = 0;
+	_currentTime = 0;
+	_keysCount = 0;
+	_offset = 0.1;
+}
+
+const std::vector<TimelineHaku>& FumenTimeline::GetHakus() const
+{
+	return _hakus;
+}
+
+const std::vector<TimelineShousetsu>& FumenTimeline::GetShousetsus() const
+{
+	return _shousetsus;
+}
+
+const std::vector<TimelineInfo>& FumenTimeline::GetInfos() const
+{
+	return _infos;
+}
+
+int FumenTimeline::GetKeysCount() const
+{
+	return _keysCount;
+}
+
+double FumenTimeline::GetLength() const
+{
+	return _currentTime;
+}
+
+double FumenTimeline::GetOffset() const
+{
+	return _offset;
+}
+
+const std::wstring& FumenTimeline::GetMusicFile() const
+{
+	return _musicFile;
+}
+
+void FumenTimeline::OnShousetsuData(const Shousetsu& s)
+{
+	if (_tempo == 0)
+		throw MyException("No tempo info!");
+
+	const std::vector<Haku>& hakus = s.GetHakus();
+
+	TimelineShousetsu ts;
+	ts.time = _currentTime;
+	ts.tempo = _tempo;
+	ts.beat = _beat;
+	ts.firstHaku = _hakus.size();
+	ts.hakuCount = hakus.size();
+
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i) {
+		TimelineHaku th;
+		th.num = i->GetNum();
+		th.time = 60 * th.num / _tempo + _currentTime;
+		th.keys = i->GetKeys().GetMask();
+		th.shousetsu = _shousetsus.size();
+		_hakus.push_back(th);
+
+		_keysCount += CountKeys(th.keys);
+	}
+	_shousetsus.push_back(ts);
+
+	_currentTime += 60 * _beat / _tempo;
+}
+
+void FumenTimeline::OnFumenInfoData(const FumenInfo& f)
+{
+	TimelineInfo ti;
+	ti.shousetsu = _shousetsus.size();
+	ti.info = f;
+	_infos.push_back(ti);
+
+	if (f.type == FumenInfo::INFOTYPE_BEATS)
+		_beat = boost::any_cast<double>(f.value);
+	else if (f.type == FumenInfo::INFOTYPE_OFFSETR)
+		_offset += boost::any_cast<double>(f.value);
+	else if (f.type == FumenInfo::INFOTYPE_OFFSETO)
+		_offset = boost::any_cast<double>(f.value);
+	else if (f.type == FumenInfo::INFOTYPE_TEMPO)
+		_tempo = boost::any_cast<double>(f.value);
+	else if (f.type == FumenInfo::INFOTYPE_MUSICFILE)
+		_musicFile = boost::any_cast<std::wstring>(f.value);
+}
+
+int CountKeys(std::uint16_t keys)
+{
+	int n = 0;
+	for (; keys != 0; keys &= keys - 1)
+		++n;
+	return n;
+}
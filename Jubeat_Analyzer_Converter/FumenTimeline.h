@@ -0,0 +1,66 @@
+#pragma once
+
+#include "FumenReader.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//a haku on the timeline. time is in seconds at speed 1, so any playback rate is just a division
+struct TimelineHaku {
+	double time;
+	double num;
+	std::uint16_t keys;
+	int shousetsu;
+};
+
+struct TimelineShousetsu {
+	double time;
+	double tempo;
+	double beat;
+	int firstHaku;
+	int hakuCount;
+};
+
+//fumen information in the order it appears, shousetsu is the index of the next bar
+struct TimelineInfo {
+	int shousetsu;
+	FumenInfo info;
+};
+
+//parse once into a rate-independent timeline, timing follows YubiosiConverter
+class FumenTimeline : public FumenParser {
+		std::vector<TimelineHaku> _hakus;
+		std::vector<TimelineShousetsu> _shousetsus;
+		std::vector<TimelineInfo> _infos;
+
+		int _keysCount;
+
+		double _tempo;
+		double _beat;
+		double _offset;
+
+		double _currentTime;
+
+		std::wstring _musicFile;
+	public:
+		FumenTimeline();
+
+		void Clear();
+
+		const std::vector<TimelineHaku>& GetHakus() const;
+		const std::vector<TimelineShousetsu>& GetShousetsus() const;
+		const std::vector<TimelineInfo>& GetInfos() const;
+
+		int GetKeysCount() const;
+		//length and offset at speed 1, in seconds and in the unit of yubiosi offset
+		double GetLength() const;
+		double GetOffset() const;
+		const std::wstring& GetMusicFile() const;
+
+	protected:
+		void OnShousetsuData(const Shousetsu& s);
+		void OnFumenInfoData(const FumenInfo& f);
+};
+
+int CountKeys(std::uint16_t keys);
@@ -0,0 +1,248 @@
+#include "Inflate.h"
+#include "MyException.h"
+
+//-------------------------------------------------------------------
+//a small canonical huffman decoder, one bit at a time.
+//fumen files are tiny, so simplicity wins over table lookups
+//-------------------------------------------------------------------
+
+namespace {
+
+const int MaxBits = 15;
+
+struct Huffman {
+	short count[MaxBits + 1];
+	short symbol[288];
+};
+
+class InflateState {
+		const unsigned char* _src;
+		std::size_t _srcLen;
+		std::size_t _pos;
+		unsigned int _bitBuf;
+		int _bitCount;
+
+		std::string& _out;
+		std::size_t _outLimit;
+
+		void CheckRoom(std::size_t len)
+		{
+			if (len > _outLimit - _out.size())
+				throw MyException("Inflate Error: data is larger than its entry size");
+		}
+	public:
+		InflateState(const unsigned char* src, std::size_t srcLen, std::string& out, std::size_t maxLen)
+			: _src(src), _srcLen(srcLen), _pos(0), _bitBuf(0), _bitCount(0), _out(out), _outLimit(out.size() + maxLen)
+		{
+		}
+
+		int Bits(int n)
+		{
+			while (_bitCount < n) {
+				if (_pos >= _srcLen)
+					throw MyException("Inflate Error: unexpected end of data");
+				_bitBuf |= static_cast<unsigned int>(_src[_pos++]) << _bitCount;
+				_bitCount += 8;
+			}
+
+			int r = _bitBuf & ((1u << n) - 1);
+			_bitBuf >>= n;
+			_bitCount -= n;
+			return r;
+		}
+
+		void Stored()
+		{
+			//skip to byte boundary
+			_bitBuf = 0;
+			_bitCount = 0;
+
+			if (_pos + 4 > _srcLen)
+				throw MyException("Inflate Error: unexpected end of data");
+			unsigned int len = _src[_pos] | (_src[_pos + 1] << 8);
+			unsigned int nlen = _src[_pos + 2] | (_src[_pos + 3] << 8);
+			_pos += 4;
+			if (len != (~nlen & 0xffff))
+				throw MyException("Inflate Error: bad stored block length");
+			if (_pos + len > _srcLen)
+				throw MyException("Inflate Error: unexpected end of data");
+
+			CheckRoom(len);
+			_out.append(reinterpret_cast<const char*>(_src + _pos), len);
+			_pos += len;
+		}
+
+		int Decode(const Huffman& h)
+		{
+			int code = 0, first = 0, index = 0;
+			for (int len = 1; len <= MaxBits; ++len) {
+				code |= Bits(1);
+				int count = h.count[len];
+				if (code - count < first)
+					return h.symbol[index + (code - first)];
+				index += count;
+				first += count;
+				first <<= 1;
+				code <<= 1;
+			}
+			throw MyException("Inflate Error: bad huffman code");
+		}
+
+		void Codes(const Huffman& lencode, const Huffman& distcode)
+		{
+			static const short lbase[29] = {
+				3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+				35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static const short lext[29] = {
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+				3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static const short dbase[30] = {
+				1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+				257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+				8193, 12289, 16385, 24577 };
+			static const short dext[30] = {
+				0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+				7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			for (;;) {
+				int symbol = Decode(lencode);
+				if (symbol < 256) {
+					CheckRoom(1);
+					_out.push_back(static_cast<char>(symbol));
+				} else if (symbol == 256) {
+					return;
+				} else {
+					symbol -= 257;
+					if (symbol >= 29)
+						throw MyException("Inflate Error: bad length symbol");
+					std::size_t len = lbase[symbol] + Bits(lext[symbol]);
+
+					symbol = Decode(distcode);
+					if (symbol >= 30)
+						throw MyException("Inflate Error: bad distance symbol");
+					std::size_t dist = dbase[symbol] + Bits(dext[symbol]);
+					if (dist > _out.size())
+						throw MyException("Inflate Error: distance too far back");
+
+					CheckRoom(len);
+
+					//byte by byte, source and destination may overlap
+					std::size_t from = _out.size() - dist;
+					for (std::size_t i = 0; i < len; ++i)
+						_out.push_back(_out[from + i]);
+				}
+			}
+		}
+};
+
+void Construct(Huffman& h, const short* lengths, int n)
+{
+	short offs[MaxBits + 1];
+
+	for (int len = 0; len <= MaxBits; ++len)
+		h.count[len] = 0;
+	for (int symbol = 0; symbol < n; ++symbol)
+		++h.count[lengths[symbol]];
+
+	offs[1] = 0;
+	for (int len = 1; len < MaxBits; ++len)
+		offs[len + 1] = offs[len] + h.count[len];
+
+	for (int symbol = 0; symbol < n; ++symbol)
+		if (lengths[symbol] != 0)
+			h.symbol[offs[lengths[symbol]]++] = symbol;
+}
+
+void Fixed(InflateState& s)
+{
+	//cheap enough to build per block, and keeps the decoder free of shared state
+	Huffman lencode, distcode;
+	short lengths[288];
+
+	int symbol = 0;
+	for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+	for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+	for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+	for (; symbol < 288; ++symbol) lengths[symbol] = 8;
+	Construct(lencode, lengths, 288);
+
+	for (symbol = 0; symbol < 30; ++symbol) lengths[symbol] = 5;
+	Construct(distcode, lengths, 30);
+
+	s.Codes(lencode, distcode);
+}
+
+void Dynamic(InflateState& s)
+{
+	static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	short lengths[288 + 32];
+	Huffman lencode, distcode;
+
+	int nlen = s.Bits(5) + 257;
+	int ndist = s.Bits(5) + 1;
+	int ncode = s.Bits(4) + 4;
+	if (nlen > 286 || ndist > 30)
+		throw MyException("Inflate Error: bad code counts");
+
+	int index = 0;
+	for (; index < ncode; ++index)
+		lengths[order[index]] = s.Bits(3);
+	for (; index < 19; ++index)
+		lengths[order[index]] = 0;
+	Construct(lencode, lengths, 19);
+
+	index = 0;
+	while (index < nlen + ndist) {
+		int symbol = s.Decode(lencode);
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+		} else {
+			short len = 0;
+			int repeat;
+			if (symbol == 16) {
+				if (index == 0)
+					throw MyException("Inflate Error: repeat with no first length");
+				len = lengths[index - 1];
+				repeat = 3 + s.Bits(2);
+			} else if (symbol == 17) {
+				repeat = 3 + s.Bits(3);
+			} else {
+				repeat = 11 + s.Bits(7);
+			}
+			if (index + repeat > nlen + ndist)
+				throw MyException("Inflate Error: too many lengths");
+			while (repeat--)
+				lengths[index++] = len;
+		}
+	}
+
+	if (lengths[256] == 0)
+		throw MyException("Inflate Error: no end of block code");
+
+	Construct(lencode, lengths, nlen);
+	Construct(distcode, lengths + nlen, ndist);
+
+	s.Codes(lencode, distcode);
+}
+
+}
+
+void Inflate(const unsigned char* src, std::size_t srcLen, std::string& out, std::size_t maxLen)
+{
+	InflateState s(src, srcLen, out, maxLen);
+
+	int last;
+	do {
+		last = s.Bits(1);
+		int type = s.Bits(2);
+		if (type == 0)
+			s.Stored();
+		else if (type == 1)
+			Fixed(s);
+		else if (type == 2)
+			Dynamic(s);
+		else
+			throw MyException("Inflate Error: bad block type");
+	} while (!last);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+//decode a raw deflate stream (rfc 1951) as stored in zip entries, appending to out.
+//throws when the stream would append more than maxLen bytes, so a bad entry cannot exhaust memory
+void Inflate(const unsigned char* src, std::size_t srcLen, std::string& out, std::size_t maxLen);
@@ -0,0 +1,435 @@
+#include "JubeatAnalyzerWriter.h"
+#include "FumenLoader.h"
+#include "FileUtil.h"
+#include "MyException.h"
+
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <locale>
+
+#include <boost/any.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace {
+
+const wchar_t EmptyCell = L'\u25a1'; //white square
+const wchar_t EmptySlot = L'\uff0d'; //full width hyphen
+const wchar_t FirstCircled = L'\u2460'; //circled 1, shift-jis goes up to circled 20
+const int CircledCount = 20;
+const int CustomGlyphCount = 52;
+
+//full width A-Z and a-z, the layout never uses them for anything else
+wchar_t GetCustomGlyph(int i)
+{
+	return static_cast<wchar_t>(i < 26 ? 0xff21 + i : 0xff41 + i - 26);
+}
+
+//shortest fixed notation that reads back as the same double, the parser takes no exponent
+std::wstring FormatNumber(double v)
+{
+	for (int precision = 0; ; ++precision) {
+		std::wostringstream s;
+		s << std::fixed << std::setprecision(precision) << v;
+		if (precision >= 20 || boost::lexical_cast<double>(s.str()) == v)
+			return s.str();
+	}
+}
+
+struct BarPosition {
+	double num;
+	std::uint16_t keys;
+	wchar_t glyph;
+};
+
+//the hakus of a bar with keys, glyphs sharing a position merged
+void GetBarPositions(const FumenTimeline& t, int shousetsu, std::vector<BarPosition>& positions)
+{
+	const TimelineShousetsu& s = t.GetShousetsus()[shousetsu];
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+
+	positions.clear();
+	for (int i = s.firstHaku, ie = s.firstHaku + s.hakuCount; i < ie; ++i) {
+		if (hakus[i].keys == 0)
+			continue;
+		if (!positions.empty() && positions.back().num == hakus[i].num) {
+			positions.back().keys |= hakus[i].keys;
+			continue;
+		}
+
+		BarPosition p;
+		p.num = hakus[i].num;
+		p.keys = hakus[i].keys;
+		p.glyph = 0;
+		positions.push_back(p);
+	}
+}
+
+class AnalyzerWriter {
+		const FumenTimeline& _t;
+		bool _twoColumn;
+		std::wstring& _text;
+
+		std::size_t _nextInfo;
+		double _tempo;
+		double _beat;
+
+		//custom glyphs stay defined for the rest of the fumen
+		bool _customDefined[CustomGlyphCount];
+		double _customNum[CustomGlyphCount];
+		int _customBar[CustomGlyphCount]; //last bar that used the glyph
+
+		std::vector<BarPosition> _positions;
+		std::vector<wchar_t> _cells; //16 per block
+		std::vector<wchar_t> _rows; //4 slots per row, two column only
+
+		void WriteLine(const std::wstring& s);
+		void WriteInfos(int shousetsu);
+		void AssignCustomGlyphs(int shousetsu);
+		void WriteShousetsu(int shousetsu);
+	public:
+		AnalyzerWriter(const FumenTimeline& t, bool twoColumn, std::wstring& text);
+
+		void Write();
+};
+
+AnalyzerWriter::AnalyzerWriter(const FumenTimeline& t, bool twoColumn, std::wstring& text)
+	: _t(t), _twoColumn(twoColumn), _text(text), _nextInfo(0), _tempo(0), _beat(0)
+{
+	for (int i = 0; i < CustomGlyphCount; ++i) {
+		_customDefined[i] = false;
+		_customNum[i] = 0;
+		_customBar[i] = -1;
+	}
+}
+
+void AnalyzerWriter::WriteLine(const std::wstring& s)
+{
+	_text += s;
+	_text += L'\n';
+}
+
+void AnalyzerWriter::Write()
+{
+	const std::vector<TimelineShousetsu>& shousetsus = _t.GetShousetsus();
+
+	//about one 4 line block per bar, grow once instead of line by line
+	_text.clear();
+	_text.reserve(32 * _t.GetInfos().size() + 48 * shousetsus.size() + 16 * _t.GetHakus().size());
+
+	WriteLine(_twoColumn ? L"#memo2" : L"#memo");
+	for (int i = 0, n = shousetsus.size(); i < n; ++i)
+		WriteShousetsu(i);
+	WriteInfos(shousetsus.size());
+}
+
+void AnalyzerWriter::WriteInfos(int shousetsu)
+{
+	const std::vector<TimelineInfo>& infos = _t.GetInfos();
+
+	//tempo and beats are written from the bars themselves, the rest in their original order
+	for (; _nextInfo < infos.size() && infos[_nextInfo].shousetsu <= shousetsu; ++_nextInfo) {
+		const FumenInfo& f = infos[_nextInfo].info;
+		if (f.type == FumenInfo::INFOTYPE_OFFSETR)
+			WriteLine(L"r=" + FormatNumber(boost::any_cast<double>(f.value)));
+		else if (f.type == FumenInfo::INFOTYPE_OFFSETO)
+			WriteLine(L"o=" + FormatNumber(boost::any_cast<double>(f.value)));
+		else if (f.type == FumenInfo::INFOTYPE_MUSICFILE)
+			WriteLine(L"m=\"" + boost::any_cast<std::wstring>(f.value) + L"\"");
+	}
+
+	if (shousetsu >= static_cast<int>(_t.GetShousetsus().size()))
+		return;
+
+	const TimelineShousetsu& s = _t.GetShousetsus()[shousetsu];
+	if (shousetsu == 0 || s.tempo != _tempo)
+		WriteLine(L"t=" + FormatNumber(s.tempo));
+	if (shousetsu == 0 || s.beat != _beat)
+		WriteLine(L"b=" + FormatNumber(s.beat));
+	_tempo = s.tempo;
+	_beat = s.beat;
+}
+
+void AnalyzerWriter::AssignCustomGlyphs(int shousetsu)
+{
+	//keep glyphs that already mean a needed position, then define the others
+	for (auto p = _positions.begin(), pe = _positions.end(); p != pe; ++p) {
+		for (int i = 0; p->glyph == 0 && i < CustomGlyphCount; ++i) {
+			if (_customDefined[i] && _customNum[i] == p->num) {
+				p->glyph = GetCustomGlyph(i);
+				_customBar[i] = shousetsu;
+			}
+		}
+	}
+
+	for (auto p = _positions.begin(), pe = _positions.end(); p != pe; ++p) {
+		if (p->glyph != 0)
+			continue;
+
+		//an undefined glyph, or the one unused for the longest time
+		int best = -1;
+		for (int i = 0; i < CustomGlyphCount; ++i) {
+			if (_customBar[i] == shousetsu)
+				continue;
+			if (best < 0 || (!_customDefined[i] && _customDefined[best]) ||
+				(_customDefined[i] == _customDefined[best] && _customBar[i] < _customBar[best]))
+				best = i;
+		}
+		if (best < 0)
+			throw MyException("Too many note positions in one bar!");
+
+		_customDefined[best] = true;
+		_customNum[best] = p->num;
+		_customBar[best] = shousetsu;
+		p->glyph = GetCustomGlyph(best);
+
+		std::wstring line(L"*");
+		line += p->glyph;
+		WriteLine(line + L":" + FormatNumber(p->num));
+	}
+}
+
+void AnalyzerWriter::WriteShousetsu(int shousetsu)
+{
+	WriteInfos(shousetsu);
+	GetBarPositions(_t, shousetsu, _positions);
+
+	//rows of a two column bar, the parser closes the bar once it has read that many
+	int nRows = 0;
+	if (_twoColumn) {
+		nRows = std::max(static_cast<int>(std::ceil(_beat - 0.01)), 1);
+		_rows.assign(4 * nRows, EmptySlot);
+	}
+
+	int nextCircled = 0;
+	int perPanel[16] = { 0 };
+	for (auto p = _positions.begin(), pe = _positions.end(); p != pe; ++p) {
+		double quarter = p->num * 4;
+		bool onGrid = quarter == std::floor(quarter) && quarter >= 0;
+		if (!_twoColumn && onGrid && quarter < 16) {
+			p->glyph = static_cast<wchar_t>(FirstCircled + static_cast<int>(quarter));
+		} else if (_twoColumn && onGrid && quarter < 4 * nRows && nextCircled < CircledCount) {
+			p->glyph = static_cast<wchar_t>(FirstCircled + nextCircled++);
+			_rows[static_cast<int>(quarter)] = p->glyph;
+		}
+
+		for (int k = 0; k < 16; ++k)
+			if (p->keys & (1 << k))
+				++perPanel[k];
+	}
+	AssignCustomGlyphs(shousetsu);
+
+	//a panel hit n times in the bar needs n blocks
+	int nBlocks = std::max(*std::max_element(perPanel, perPanel + 16), 1);
+	if (_twoColumn)
+		nBlocks = std::max(nBlocks, (nRows + 3) / 4);
+	_cells.assign(16 * nBlocks, EmptyCell);
+	for (auto p = _positions.cbegin(), pe = _positions.cend(); p != pe; ++p) {
+		for (int k = 0; k < 16; ++k) {
+			if (!(p->keys & (1 << k)))
+				continue;
+			int b = 0;
+			while (_cells[16 * b + k] != EmptyCell)
+				++b;
+			_cells[16 * b + k] = p->glyph;
+		}
+	}
+
+	if (_twoColumn)
+		WriteLine(boost::lexical_cast<std::wstring>(shousetsu + 1));
+
+	//two column rows go on the last lines, so the bar cannot close before its last block
+	int nLines = 4 * nBlocks, firstRowLine = nLines - nRows;
+	for (int l = 0; l < nLines; ++l) {
+		std::wstring line(&_cells[4 * l], 4);
+		if (_twoColumn && l >= firstRowLine) {
+			line += L" |";
+			line.append(&_rows[4 * (l - firstRowLine)], 4);
+			line += L'|';
+		}
+		WriteLine(line);
+	}
+
+	if (!_twoColumn)
+		WriteLine(L"--");
+}
+
+typedef std::codecvt<wchar_t, char, std::mbstate_t> MyCodeCvt;
+
+void AppendEncoded(std::string& bytes, const wchar_t* begin, const wchar_t* end, const std::locale& loc)
+{
+	if (begin == end)
+		return;
+
+	const MyCodeCvt& cvt = std::use_facet<MyCodeCvt>(loc);
+	std::size_t start = bytes.size();
+	bytes.resize(start + (end - begin) * std::max(cvt.max_length(), 1));
+
+	std::mbstate_t state = std::mbstate_t();
+	const wchar_t* inNext;
+	char* outNext;
+	char* out = &bytes[0] + start;
+	if (cvt.out(state, begin, end, inNext, out, &bytes[0] + bytes.size(), outNext) != MyCodeCvt::ok || inNext != end)
+		throw MyException("Cannot encode fumen text!");
+	bytes.resize(outNext - &bytes[0]);
+}
+
+struct TimelinePosition {
+	double num;
+	std::uint16_t keys;
+
+	bool operator == (const TimelinePosition& p) const
+	{
+		return num == p.num && keys == p.keys;
+	}
+};
+
+void GetTimelinePositions(const FumenTimeline& t, int shousetsu, std::vector<TimelinePosition>& positions)
+{
+	std::vector<BarPosition> bar;
+	GetBarPositions(t, shousetsu, bar);
+
+	positions.clear();
+	for (auto i = bar.cbegin(), e = bar.cend(); i != e; ++i) {
+		TimelinePosition p;
+		p.num = i->num;
+		p.keys = i->keys;
+		positions.push_back(p);
+	}
+}
+
+}
+
+void WriteJubeatAnalyzer(const FumenTimeline& t, bool twoColumn, std::wstring& text)
+{
+	AnalyzerWriter w(t, twoColumn, text);
+	w.Write();
+}
+
+void EncodeJubeatAnalyzer(const std::wstring& text, std::string& bytes)
+{
+	const std::locale& jpLoc = GetJapaneseLocale();
+	const std::locale& defLoc = GetDefaultLocale();
+
+	bytes.clear();
+	bytes.reserve(2 * text.size() + text.size() / 4);
+
+	//the same choice of encoding per line as ReadFumenLines
+	for (std::wstring::size_type pos = 0; pos < text.size(); ) {
+		std::wstring::size_type end = text.find(L'\n', pos);
+		if (end == std::wstring::npos)
+			end = text.size();
+
+		const wchar_t* line = text.data() + pos;
+		AppendEncoded(bytes, line, line + (end - pos), end - pos > 3 && line[0] == L'm' ? defLoc : jpLoc);
+		bytes += "\r\n";
+		pos = end + 1;
+	}
+}
+
+bool IsSameTimeline(const FumenTimeline& a, const FumenTimeline& b)
+{
+	const std::vector<TimelineShousetsu>& as = a.GetShousetsus();
+	const std::vector<TimelineShousetsu>& bs = b.GetShousetsus();
+	if (as.size() != bs.size() || a.GetOffset() != b.GetOffset() || a.GetMusicFile() != b.GetMusicFile())
+		return false;
+
+	std::vector<TimelinePosition> ap, bp;
+	for (int i = 0, n = as.size(); i < n; ++i) {
+		if (as[i].tempo != bs[i].tempo || as[i].beat != bs[i].beat)
+			return false;
+
+		GetTimelinePositions(a, i, ap);
+		GetTimelinePositions(b, i, bp);
+		if (ap != bp)
+			return false;
+	}
+	return true;
+}
+
+//parse, write, encode and parse the output again
+static void NormalizeBytes(const std::string& input, bool twoColumn, std::wstring& text, std::string& output)
+{
+	FumenTimeline t;
+	ParseFumenBytes(input, t);
+
+	WriteJubeatAnalyzer(t, twoColumn, text);
+	EncodeJubeatAnalyzer(text, output);
+
+	FumenTimeline check;
+	ParseFumenBytes(output, check);
+	if (!IsSameTimeline(t, check))
+		throw MyException("Normalized fumen does not match its input!");
+}
+
+static void WriteFileBytes(const std::wstring& file, const std::string& bytes)
+{
+	std::fstream fs(file.c_str(), std::ios::out | std::ios::binary);
+	fs.write(bytes.data(), bytes.size());
+	fs.close();
+	if (fs.fail())
+		throw MyException("Cannot write output file!");
+}
+
+void NormalizeFumen(const std::wstring& input, const std::wstring& output, bool twoColumn)
+{
+	std::string bytes, out;
+	std::wstring text;
+	if (!ReadFileBytes(input, bytes))
+		throw MyException("Cannot open input file!");
+
+	NormalizeBytes(bytes, twoColumn, text, out);
+	WriteFileBytes(output, out);
+}
+
+NormalizeStats NormalizeFumens(const std::wstring& inputDir, const std::wstring& outputDir, bool twoColumn, int nThreads, std::ostream& log)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	vector<wstring> files;
+	ListFiles(inputDir, L".txt", false, files);
+
+	atomic<size_t> next(0);
+	atomic<int> nNormalized(0), nFailed(0);
+	mutex logMutex;
+	vector<thread> workers;
+	for (int n = 0; n < max(nThreads, 1); ++n) {
+		workers.push_back(thread([&]() {
+			//buffers keep their capacity from one fumen to the next
+			string bytes, out;
+			wstring text;
+			for (size_t i; (i = next++) < files.size(); ) {
+				try {
+					if (!ReadFileBytes(files[i], bytes))
+						throw MyException("Cannot open input file!");
+
+					NormalizeBytes(bytes, twoColumn, text, out);
+					WriteFileBytes(JoinPath(outputDir, GetBaseName(files[i])), out);
+					++nNormalized;
+				} catch (exception& e) {
+					lock_guard<mutex> lock(logMutex);
+					log << ToUtf8(files[i]) << ": " << e.what() << endl;
+					++nFailed;
+				}
+			}
+		}));
+	}
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+
+	NormalizeStats stats;
+	stats.normalized = nNormalized;
+	stats.failed = nFailed;
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return stats;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "FumenTimeline.h"
+
+#include <string>
+#include <ostream>
+
+//serialize a timeline back into jubeat analyzer text. text is cleared first and keeps its capacity.
+//one column bars use the default glyphs (1) to (16) for quarter beat positions, two column bars number
+//their positions in the |....| rows. other positions get *X:num lines with full width letters, which
+//stay defined across bars and are only redefined when a bar needs a new position.
+//a panel hit more than once in a bar goes into another 4 line block. t= and b= are written before
+//the first bar and wherever they change, the other information lines stay where they were
+void WriteJubeatAnalyzer(const FumenTimeline& t, bool twoColumn, std::wstring& text);
+
+//encode like the files the parser reads: shift-jis, and the music file line in the default encoding
+void EncodeJubeatAnalyzer(const std::wstring& text, std::string& bytes);
+
+//same bars, tempos, beats, haku positions and keys, offset and music file
+bool IsSameTimeline(const FumenTimeline& a, const FumenTimeline& b);
+
+struct NormalizeStats {
+	int normalized;
+	int failed;
+	double seconds;
+};
+
+//write every .txt of inputDir in the canonical layout on nThreads threads.
+//every output is parsed again and must give the same timeline as its input before it is written
+NormalizeStats NormalizeFumens(const std::wstring& inputDir, const std::wstring& outputDir, bool twoColumn, int nThreads, std::ostream& log);
+
+//the same for one file
+void NormalizeFumen(const std::wstring& input, const std::wstring& output, bool twoColumn);
@@ -0,0 +1,423 @@
+#include "PatternIndex.h"
+#include "FumenLoader.h"
+#include "MyException.h"
+
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/lexical_cast.hpp>
+
+static const char PatternMagic[8] = { 'J', 'A', 'P', 'A', 'T', 'R', 'N', '1' };
+static const std::size_t PatternHeaderSize = 32;
+
+namespace {
+
+//each symmetry is a permutation of the 16 bits, applied a byte at a time
+struct SymmetryTables {
+	std::uint16_t low[SymmetryCount][256];
+	std::uint16_t high[SymmetryCount][256];
+
+	SymmetryTables()
+	{
+		for (int s = 0; s < SymmetryCount; ++s) {
+			int target[16];
+			for (int r = 0; r < 4; ++r) {
+				for (int c = 0; c < 4; ++c) {
+					int tr = r, tc = s < 4 ? c : 3 - c;
+					for (int k = 0; k < s % 4; ++k) {
+						int t = tr;
+						tr = tc;
+						tc = 3 - t;
+					}
+					target[r * 4 + c] = tr * 4 + tc;
+				}
+			}
+
+			for (int b = 0; b < 256; ++b) {
+				low[s][b] = high[s][b] = 0;
+				for (int bit = 0; bit < 8; ++bit) {
+					if (b & (1 << bit)) {
+						low[s][b] |= 1 << target[bit];
+						high[s][b] |= 1 << target[bit + 8];
+					}
+				}
+			}
+		}
+	}
+};
+
+//built before main, so it is safe to share between threads
+const SymmetryTables Symmetries;
+
+std::uint64_t CanonicalKey(const std::uint16_t* masks)
+{
+	std::uint64_t best = 0;
+	for (int s = 0; s < SymmetryCount; ++s) {
+		std::uint64_t key = 0;
+		for (int i = 0; i < PatternGram; ++i)
+			key = (key << 16) | TransformMask(masks[i], s);
+		if (s == 0 || key < best)
+			best = key;
+	}
+	return best;
+}
+
+}
+
+std::uint16_t TransformMask(std::uint16_t mask, int symmetry)
+{
+	return Symmetries.low[symmetry][mask & 0xff] | Symmetries.high[symmetry][mask >> 8];
+}
+
+void GetPatternSteps(const FumenTimeline& t, std::vector<PatternStep>& steps)
+{
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+
+	steps.clear();
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i) {
+		if (i->keys == 0)
+			continue;
+
+		//hakus are sorted by position, glyphs sharing a position are one step
+		if (!steps.empty() && steps.back().shousetsu == i->shousetsu && steps.back().num == static_cast<float>(i->num)) {
+			steps.back().mask |= i->keys;
+			continue;
+		}
+
+		PatternStep s;
+		s.mask = i->keys;
+		s.shousetsu = i->shousetsu;
+		s.num = static_cast<float>(i->num);
+		s.time = static_cast<float>(i->time);
+		steps.push_back(s);
+	}
+}
+
+void ParsePattern(const std::string& text, std::vector<std::uint16_t>& pattern)
+{
+	pattern.clear();
+
+	std::string::size_type pos = 0;
+	while (pos < text.length()) {
+		std::string::size_type end = text.find_first_of(" ,", pos);
+		if (end == std::string::npos)
+			end = text.length();
+
+		if (end > pos) {
+			std::uint16_t mask = 0;
+			std::string step = text.substr(pos, end - pos);
+			std::string::size_type p = 0;
+			while (p <= step.length()) {
+				std::string::size_type q = step.find('+', p);
+				if (q == std::string::npos)
+					q = step.length();
+
+				int panel = boost::lexical_cast<int>(step.substr(p, q - p));
+				if (panel < 1 || panel > 16)
+					throw MyException("Pattern panels must be 1-16!");
+				mask |= 1 << (panel - 1);
+				p = q + 1;
+			}
+			pattern.push_back(mask);
+		}
+		pos = end + 1;
+	}
+
+	if (pattern.empty())
+		throw MyException("Empty pattern!");
+}
+
+//-------------------------------------------------------------------
+//impl for pattern index view
+//-------------------------------------------------------------------
+
+PatternIndexView::PatternIndexView()
+	: _fumenCount(0), _stepCount(0), _keyCount(0)
+{
+}
+
+bool PatternIndexView::Open(const std::wstring& indexFile)
+{
+	Close();
+
+	if (!_file.Open(indexFile))
+		return false;
+
+	const char* p = _file.GetData();
+	std::size_t size = _file.GetSize();
+	if (size < PatternHeaderSize || std::memcmp(p, PatternMagic, 8) != 0)
+		throw MyException("Pattern Index Error: not a pattern index");
+
+	std::uint32_t fumenCount, stepCount, keyCount, postingCount, stringsSize;
+	std::memcpy(&fumenCount, p + 8, 4);
+	std::memcpy(&stepCount, p + 12, 4);
+	std::memcpy(&keyCount, p + 16, 4);
+	std::memcpy(&postingCount, p + 20, 4);
+	std::memcpy(&stringsSize, p + 24, 4);
+
+	std::size_t expected = PatternHeaderSize + 8 * static_cast<std::size_t>(keyCount)
+		+ 4 * (static_cast<std::size_t>(keyCount) + 1) + 4 * static_cast<std::size_t>(postingCount)
+		+ 4 * (static_cast<std::size_t>(fumenCount) + 1) + 4 * static_cast<std::size_t>(fumenCount)
+		+ 14 * static_cast<std::size_t>(stepCount) + stringsSize;
+	if (size != expected)
+		throw MyException("Pattern Index Error: index size mismatch");
+
+	//wider columns come first so every column stays aligned in the mapping
+	const char* col = p + PatternHeaderSize;
+	_key = reinterpret_cast<const std::uint64_t*>(col); col += 8 * keyCount;
+	_postingBegin = reinterpret_cast<const std::uint32_t*>(col); col += 4 * (keyCount + 1);
+	_posting = reinterpret_cast<const std::uint32_t*>(col); col += 4 * postingCount;
+	_stepBegin = reinterpret_cast<const std::uint32_t*>(col); col += 4 * (fumenCount + 1);
+	_pathOffset = reinterpret_cast<const std::uint32_t*>(col); col += 4 * fumenCount;
+	_shousetsu = reinterpret_cast<const std::int32_t*>(col); col += 4 * stepCount;
+	_num = reinterpret_cast<const float*>(col); col += 4 * stepCount;
+	_time = reinterpret_cast<const float*>(col); col += 4 * stepCount;
+	_mask = reinterpret_cast<const std::uint16_t*>(col); col += 2 * stepCount;
+	_strings = col;
+
+	if (_postingBegin[keyCount] != postingCount || _stepBegin[fumenCount] != stepCount)
+		throw MyException("Pattern Index Error: bad column");
+	for (std::uint32_t i = 0; i < postingCount; ++i)
+		if (_posting[i] >= stepCount)
+			throw MyException("Pattern Index Error: bad posting");
+	for (std::uint32_t i = 0; i < fumenCount; ++i)
+		if (_pathOffset[i] >= stringsSize || _stepBegin[i] > _stepBegin[i + 1])
+			throw MyException("Pattern Index Error: bad fumen");
+	if (stringsSize != 0 && _strings[stringsSize - 1] != '\0')
+		throw MyException("Pattern Index Error: bad string pool");
+
+	_fumenCount = fumenCount;
+	_stepCount = stepCount;
+	_keyCount = keyCount;
+	return true;
+}
+
+void PatternIndexView::Close()
+{
+	_file.Close();
+	_fumenCount = _stepCount = _keyCount = 0;
+}
+
+std::size_t PatternIndexView::GetFumenCount() const
+{
+	return _fumenCount;
+}
+
+const char* PatternIndexView::GetPath(std::size_t fumen) const
+{
+	return _strings + _pathOffset[fumen];
+}
+
+bool PatternIndexView::Match(const std::vector<std::uint16_t>& pattern, std::size_t fumen, std::uint32_t start, bool symmetric, PatternHit& hit) const
+{
+	if (start < _stepBegin[fumen] || start + pattern.size() > _stepBegin[fumen + 1])
+		return false;
+
+	for (int s = 0; s < (symmetric ? SymmetryCount : 1); ++s) {
+		std::size_t i = 0;
+		while (i < pattern.size() && TransformMask(pattern[i], s) == _mask[start + i])
+			++i;
+		if (i == pattern.size()) {
+			hit.fumen = fumen;
+			hit.shousetsu = _shousetsu[start];
+			hit.num = _num[start];
+			hit.time = _time[start];
+			hit.symmetry = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+void PatternIndexView::Find(const std::vector<std::uint16_t>& pattern, bool symmetric, std::vector<PatternHit>& hits) const
+{
+	hits.clear();
+	if (pattern.empty() || _stepCount == 0)
+		return;
+
+	PatternHit hit;
+	if (pattern.size() < static_cast<std::size_t>(PatternGram)) {
+		std::size_t fumen = 0;
+		for (std::uint32_t start = 0; start < _stepCount; ++start) {
+			while (start >= _stepBegin[fumen + 1])
+				++fumen;
+			if (Match(pattern, fumen, start, symmetric, hit))
+				hits.push_back(hit);
+		}
+		return;
+	}
+
+	//look up the rarest run of the pattern and verify around each of its postings
+	std::size_t bestOffset = 0;
+	std::uint32_t bestBegin = 0, bestEnd = 0;
+	for (std::size_t k = 0; k + PatternGram <= pattern.size(); ++k) {
+		std::uint64_t key = CanonicalKey(&pattern[k]);
+		const std::uint64_t* found = std::lower_bound(_key, _key + _keyCount, key);
+		if (found == _key + _keyCount || *found != key)
+			return;
+
+		std::size_t i = found - _key;
+		if (k == 0 || _postingBegin[i + 1] - _postingBegin[i] < bestEnd - bestBegin) {
+			bestOffset = k;
+			bestBegin = _postingBegin[i];
+			bestEnd = _postingBegin[i + 1];
+		}
+	}
+
+	for (std::uint32_t i = bestBegin; i < bestEnd; ++i) {
+		std::uint32_t step = _posting[i];
+		if (step < bestOffset)
+			continue;
+
+		std::size_t fumen = std::upper_bound(_stepBegin, _stepBegin + _fumenCount + 1, step) - _stepBegin - 1;
+		if (Match(pattern, fumen, static_cast<std::uint32_t>(step - bestOffset), symmetric, hit))
+			hits.push_back(hit);
+	}
+}
+
+//-------------------------------------------------------------------
+//impl for pattern index building
+//-------------------------------------------------------------------
+
+template<class T, class F>
+static void AppendStepColumn(std::string& s, const std::vector< std::vector<PatternStep> >& steps, F PatternStep::*field)
+{
+	for (auto i = steps.cbegin(), e = steps.cend(); i != e; ++i) {
+		for (auto j = i->cbegin(), je = i->cend(); j != je; ++j) {
+			T v = static_cast<T>((*j).*field);
+			s.append(reinterpret_cast<const char*>(&v), sizeof(T));
+		}
+	}
+}
+
+template<class T>
+static void AppendArray(std::string& s, const std::vector<T>& v)
+{
+	if (!v.empty())
+		s.append(reinterpret_cast<const char*>(&v[0]), sizeof(T) * v.size());
+}
+
+void SavePatternIndex(const std::vector<std::string>& paths, const std::vector< std::vector<PatternStep> >& steps, const std::wstring& indexFile)
+{
+	std::vector<std::uint32_t> stepBegin(1, 0);
+	std::vector< std::pair<std::uint64_t, std::uint32_t> > grams;
+	std::vector<std::uint16_t> masks;
+	for (auto i = steps.cbegin(), e = steps.cend(); i != e; ++i) {
+		std::uint32_t base = stepBegin.back();
+		for (auto j = i->cbegin(), je = i->cend(); j != je; ++j)
+			masks.push_back(j->mask);
+		for (std::size_t k = 0; k + PatternGram <= i->size(); ++k)
+			grams.push_back(std::make_pair(CanonicalKey(&masks[base + k]), static_cast<std::uint32_t>(base + k)));
+		stepBegin.push_back(masks.size());
+	}
+	std::sort(grams.begin(), grams.end());
+
+	std::vector<std::uint64_t> keys;
+	std::vector<std::uint32_t> postingBegin, postings;
+	postings.reserve(grams.size());
+	for (auto i = grams.cbegin(), e = grams.cend(); i != e; ++i) {
+		if (keys.empty() || keys.back() != i->first) {
+			keys.push_back(i->first);
+			postingBegin.push_back(postings.size());
+		}
+		postings.push_back(i->second);
+	}
+	postingBegin.push_back(postings.size());
+
+	std::string strings;
+	std::vector<std::uint32_t> pathOffsets;
+	for (auto i = paths.cbegin(), e = paths.cend(); i != e; ++i) {
+		pathOffsets.push_back(strings.size());
+		strings.append(i->c_str(), i->length() + 1);
+	}
+
+	std::uint32_t header[5] = {
+		static_cast<std::uint32_t>(paths.size()), static_cast<std::uint32_t>(masks.size()),
+		static_cast<std::uint32_t>(keys.size()), static_cast<std::uint32_t>(postings.size()),
+		static_cast<std::uint32_t>(strings.size())
+	};
+
+	std::string s;
+	s.reserve(PatternHeaderSize + 8 * keys.size() + 4 * (postingBegin.size() + postings.size())
+		+ 8 * (paths.size() + 1) + 14 * masks.size() + strings.size());
+	s.append(PatternMagic, 8);
+	s.append(reinterpret_cast<const char*>(header), sizeof(header));
+	s.append(PatternHeaderSize - s.size(), '\0');
+
+	AppendArray(s, keys);
+	AppendArray(s, postingBegin);
+	AppendArray(s, postings);
+	AppendArray(s, stepBegin);
+	AppendArray(s, pathOffsets);
+	AppendStepColumn<std::int32_t>(s, steps, &PatternStep::shousetsu);
+	AppendStepColumn<float>(s, steps, &PatternStep::num);
+	AppendStepColumn<float>(s, steps, &PatternStep::time);
+	AppendArray(s, masks);
+	s += strings;
+
+	//write aside and swap, so readers never map a half written index
+	std::wstring tmpFile = indexFile + L".tmp";
+	{
+		std::fstream fs(tmpFile.c_str(), std::ios::out | std::ios::binary);
+		fs.write(s.data(), s.size());
+		fs.close();
+		if (fs.fail())
+			throw MyException("Cannot write pattern index!");
+	}
+	if (!RenameFile(tmpFile, indexFile))
+		throw MyException("Cannot replace pattern index!");
+}
+
+int BuildPatternIndex(const std::wstring& libraryDir, const std::wstring& indexFile, int nThreads, std::ostream& log)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	vector<wstring> files;
+	ListFiles(libraryDir, L".txt", true, files);
+
+	vector< vector<PatternStep> > steps(files.size());
+	vector<char> valid(files.size(), 0);
+
+	atomic<size_t> next(0);
+	mutex logMutex;
+	vector<thread> workers;
+	for (int n = 0; n < max(nThreads, 1); ++n) {
+		workers.push_back(thread([&]() {
+			for (size_t i; (i = next++) < files.size(); ) {
+				try {
+					string bytes;
+					if (!ReadFileBytes(files[i], bytes))
+						throw MyException("Cannot open input file!");
+
+					FumenTimeline t;
+					ParseFumenBytes(bytes, t);
+					GetPatternSteps(t, steps[i]);
+					valid[i] = 1;
+				} catch (exception& e) {
+					lock_guard<mutex> lock(logMutex);
+					log << ToUtf8(files[i]) << ": " << e.what() << endl;
+				}
+			}
+		}));
+	}
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+
+	vector<string> validPaths;
+	vector< vector<PatternStep> > validSteps;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (valid[i]) {
+			validPaths.push_back(ToUtf8(files[i]));
+			validSteps.push_back(move(steps[i]));
+		}
+	}
+
+	SavePatternIndex(validPaths, validSteps, indexFile);
+	return validPaths.size();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "FumenTimeline.h"
+#include "FileUtil.h"
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+//masks use the HakuKeys layout, bit r * 4 + c.
+//the 8 symmetries of the 4x4 grid are the 4 rotations, each optionally mirrored. 0 is the identity
+const int SymmetryCount = 8;
+std::uint16_t TransformMask(std::uint16_t mask, int symmetry);
+
+//one step of a pattern: every haku at the same position merged into one mask
+struct PatternStep {
+	std::uint16_t mask;
+	int shousetsu;
+	float num; //beats from the start of the bar
+	float time; //seconds at speed 1
+};
+
+void GetPatternSteps(const FumenTimeline& t, std::vector<PatternStep>& steps);
+
+//steps separated by spaces or commas, panels 1-16 of a step joined by '+': "1 6 11 16", "1+4,13+16"
+void ParsePattern(const std::string& text, std::vector<std::uint16_t>& pattern);
+
+//the index is keyed by runs of PatternGram steps, shorter patterns are answered by a scan
+const int PatternGram = 3;
+
+struct PatternHit {
+	std::size_t fumen;
+	int shousetsu;
+	float num;
+	float time;
+	int symmetry; //the symmetry that maps the pattern onto the fumen
+};
+
+//read-only view of a pattern index through a memory mapping.
+//every run of PatternGram steps is keyed by the smallest of its 8 transformed forms, so one lookup
+//finds all rotations and mirrors. the file layout:
+//  "JAPATRN1" fumenCount stepCount keyCount postingCount stringsSize padding
+//  uint64 key[] (sorted), uint32 postingBegin[keyCount + 1], uint32 posting[] (first step of the run),
+//  uint32 stepBegin[fumenCount + 1], uint32 pathOffset[],
+//  int32 shousetsu[], float num[], float time[], uint16 mask[], strings
+class PatternIndexView : boost::noncopyable {
+		MappedFile _file;
+		std::uint32_t _fumenCount;
+		std::uint32_t _stepCount;
+		std::uint32_t _keyCount;
+		const std::uint64_t* _key;
+		const std::uint32_t* _postingBegin;
+		const std::uint32_t* _posting;
+		const std::uint32_t* _stepBegin;
+		const std::uint32_t* _pathOffset;
+		const std::int32_t* _shousetsu;
+		const float* _num;
+		const float* _time;
+		const std::uint16_t* _mask;
+		const char* _strings;
+
+		bool Match(const std::vector<std::uint16_t>& pattern, std::size_t fumen, std::uint32_t start, bool symmetric, PatternHit& hit) const;
+	public:
+		PatternIndexView();
+
+		//false if the index does not exist, throws if it is broken
+		bool Open(const std::wstring& indexFile);
+		void Close();
+
+		std::size_t GetFumenCount() const;
+		const char* GetPath(std::size_t fumen) const; //utf-8
+
+		//hits in fumen and step order. symmetric also matches rotations and mirrors of the pattern
+		void Find(const std::vector<std::uint16_t>& pattern, bool symmetric, std::vector<PatternHit>& hits) const;
+};
+
+void SavePatternIndex(const std::vector<std::string>& paths, const std::vector< std::vector<PatternStep> >& steps, const std::wstring& indexFile);
+
+//build the pattern index of every .txt under libraryDir on nThreads threads.
+//returns the number of fumens indexed
+int BuildPatternIndex(const std::wstring& libraryDir, const std::wstring& indexFile, int nThreads, std::ostream& log);
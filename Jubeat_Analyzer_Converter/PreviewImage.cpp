@@ -0,0 +1,237 @@
+#include "PreviewImage.h"
+
+#include <algorithm>
+
+#include <boost/crc.hpp>
+#include <boost/lexical_cast.hpp>
+
+PreviewImage::PreviewImage(int width, int height)
+	: _width(width), _height(height), _pixels(3 * width * height, 0)
+{
+}
+
+int PreviewImage::GetWidth() const
+{
+	return _width;
+}
+
+int PreviewImage::GetHeight() const
+{
+	return _height;
+}
+
+const std::uint8_t* PreviewImage::GetPixels() const
+{
+	return &_pixels[0];
+}
+
+void PreviewImage::Fill(std::uint32_t rgb)
+{
+	FillRect(0, 0, _width, _height, rgb);
+}
+
+void PreviewImage::FillRect(int x, int y, int w, int h, std::uint32_t rgb)
+{
+	int x0 = std::max(x, 0), x1 = std::min(x + w, _width);
+	int y0 = std::max(y, 0), y1 = std::min(y + h, _height);
+	std::uint8_t r = rgb >> 16, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+	for (int py = y0; py < y1; ++py) {
+		std::uint8_t* p = &_pixels[3 * (py * _width + x0)];
+		for (int px = x0; px < x1; ++px) {
+			*p++ = r;
+			*p++ = g;
+			*p++ = b;
+		}
+	}
+}
+
+static void AppendBE32(std::string& s, std::uint32_t v)
+{
+	s += static_cast<char>(v >> 24);
+	s += static_cast<char>(v >> 16);
+	s += static_cast<char>(v >> 8);
+	s += static_cast<char>(v);
+}
+
+//length, type and data, then the crc of type and data
+static void AppendChunk(std::string& s, const char* type, const std::string& data)
+{
+	AppendBE32(s, data.size());
+	std::size_t start = s.size();
+	s.append(type, 4);
+	s += data;
+
+	boost::crc_32_type crc;
+	crc.process_bytes(s.data() + start, s.size() - start);
+	AppendBE32(s, crc.checksum());
+}
+
+//-------------------------------------------------------------------
+//a deflate writer with the fixed huffman codes and run-length matches only.
+//previews are flat colour, after the up filter nearly every byte repeats the one 1 or 3 before it
+//-------------------------------------------------------------------
+
+namespace {
+
+class FixedDeflateWriter {
+		std::string& _out;
+		std::uint32_t _bitBuf;
+		int _bitCount;
+
+		//huffman codes go most significant bit first
+		void Code(std::uint32_t code, int n)
+		{
+			std::uint32_t r = 0;
+			for (int i = 0; i < n; ++i, code >>= 1)
+				r = (r << 1) | (code & 1);
+			Bits(r, n);
+		}
+
+		void Symbol(int symbol)
+		{
+			if (symbol < 144)
+				Code(0x30 + symbol, 8);
+			else if (symbol < 256)
+				Code(0x190 + symbol - 144, 9);
+			else if (symbol < 280)
+				Code(symbol - 256, 7);
+			else
+				Code(0xc0 + symbol - 280, 8);
+		}
+	public:
+		FixedDeflateWriter(std::string& out)
+			: _out(out), _bitBuf(0), _bitCount(0)
+		{
+			//one final block with fixed codes
+			Bits(1, 1);
+			Bits(1, 2);
+		}
+
+		void Bits(std::uint32_t v, int n)
+		{
+			_bitBuf |= v << _bitCount;
+			_bitCount += n;
+			while (_bitCount >= 8) {
+				_out += static_cast<char>(_bitBuf & 0xff);
+				_bitBuf >>= 8;
+				_bitCount -= 8;
+			}
+		}
+
+		void Literal(std::uint8_t c)
+		{
+			Symbol(c);
+		}
+
+		//3 <= len <= 258, 1 <= dist <= 4
+		void Match(int len, int dist)
+		{
+			static const short lbase[29] = {
+				3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+				35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static const short lext[29] = {
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+				3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+			int l = 28;
+			while (lbase[l] > len)
+				--l;
+			Symbol(257 + l);
+			Bits(len - lbase[l], lext[l]);
+
+			//distance codes 0-3 stand for 1-4 and have no extra bits
+			Code(dist - 1, 5);
+		}
+
+		void Finish()
+		{
+			Symbol(256);
+			if (_bitCount > 0)
+				Bits(0, 8 - _bitCount);
+		}
+};
+
+}
+
+void EncodePng(const PreviewImage& image, std::string& bytes)
+{
+	static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+
+	int w = image.GetWidth(), h = image.GetHeight();
+	std::size_t stride = 3 * w;
+
+	std::string header;
+	AppendBE32(header, w);
+	AppendBE32(header, h);
+	header += '\x08'; //bit depth
+	header += '\x02'; //truecolor
+	header.append(3, '\0'); //deflate, adaptive filtering, no interlace
+
+	//every row uses the up filter, the first row has zeros above it
+	std::size_t rowSize = stride + 1;
+	std::size_t rawSize = rowSize * h;
+	const std::uint8_t* pixels = image.GetPixels();
+	auto raw = [&](std::size_t pos) -> std::uint8_t {
+		std::size_t row = pos / rowSize, col = pos % rowSize;
+		if (col == 0)
+			return 2;
+		std::uint8_t c = pixels[row * stride + col - 1];
+		return row == 0 ? c : static_cast<std::uint8_t>(c - pixels[(row - 1) * stride + col - 1]);
+	};
+
+	//zlib stream: header, one fixed huffman block, adler32 of the raw data
+	std::string data;
+	data.reserve(rawSize / 8);
+	data += '\x78';
+	data += '\x01';
+
+	FixedDeflateWriter deflate(data);
+	std::uint32_t a = 1, b = 0;
+	for (std::size_t pos = 0; pos < rawSize; ) {
+		//the longest repeat of the byte before or of the pixel before
+		std::size_t best = 0, bestDist = 0;
+		for (std::size_t dist = 1; dist <= 3; dist += 2) {
+			if (pos < dist)
+				continue;
+			std::size_t len = 0;
+			while (len < 258 && pos + len < rawSize && raw(pos + len) == raw(pos + len - dist))
+				++len;
+			if (len > best) {
+				best = len;
+				bestDist = dist;
+			}
+		}
+
+		std::size_t n = best >= 3 ? best : 1;
+		if (best >= 3)
+			deflate.Match(best, bestDist);
+		else
+			deflate.Literal(raw(pos));
+
+		for (std::size_t end = pos + n; pos < end; ++pos) {
+			a = (a + raw(pos)) % 65521;
+			b = (b + a) % 65521;
+		}
+	}
+	deflate.Finish();
+	AppendBE32(data, (b << 16) | a);
+
+	bytes.clear();
+	bytes.reserve(8 + 25 + 12 + data.size() + 12);
+	bytes.append(signature, 8);
+	AppendChunk(bytes, "IHDR", header);
+	AppendChunk(bytes, "IDAT", data);
+	AppendChunk(bytes, "IEND", std::string());
+}
+
+void EncodePpm(const PreviewImage& image, std::string& bytes)
+{
+	std::string header = "P6\n" + boost::lexical_cast<std::string>(image.GetWidth()) + " "
+		+ boost::lexical_cast<std::string>(image.GetHeight()) + "\n255\n";
+
+	std::size_t size = 3 * image.GetWidth() * image.GetHeight();
+	bytes.clear();
+	bytes.reserve(header.size() + size);
+	bytes += header;
+	bytes.append(reinterpret_cast<const char*>(image.GetPixels()), size);
+}
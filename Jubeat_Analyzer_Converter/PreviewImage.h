@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//8 bit rgb raster, rows top to bottom
+class PreviewImage {
+		int _width;
+		int _height;
+		std::vector<std::uint8_t> _pixels;
+	public:
+		PreviewImage(int width, int height);
+
+		int GetWidth() const;
+		int GetHeight() const;
+		const std::uint8_t* GetPixels() const;
+
+		void Fill(std::uint32_t rgb);
+		//clipped to the image
+		void FillRect(int x, int y, int w, int h, std::uint32_t rgb);
+};
+
+//encode into bytes, which keeps its capacity between calls.
+//png rows use the up filter and one fixed huffman deflate block with run-length matches,
+//which shrinks the flat colour previews without a full compressor
+void EncodePng(const PreviewImage& image, std::string& bytes);
+void EncodePpm(const PreviewImage& image, std::string& bytes);
@@ -0,0 +1,189 @@
+#include "PreviewRenderer.h"
+#include "FumenLoader.h"
+#include "FileUtil.h"
+#include "MyException.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/crc.hpp>
+
+//bump when the picture or its encoding changes, so every preview is made again
+static const char PreviewVersion[] = "preview2";
+
+static const std::uint32_t BackgroundColor = 0x181820;
+static const std::uint32_t GridColor = 0x303044;
+static const std::uint32_t HeatmapBorderColor = 0x000000;
+
+//dark blue through orange to pale yellow
+static std::uint32_t Ramp(double v)
+{
+	static const double stops[3][3] = { { 0x20, 0x28, 0x70 }, { 0xff, 0x90, 0x20 }, { 0xff, 0xf0, 0xc0 } };
+
+	v = std::min(std::max(v, 0.0), 1.0) * 2;
+	int i = std::min(static_cast<int>(v), 1);
+	double f = v - i;
+
+	std::uint32_t rgb = 0;
+	for (int c = 0; c < 3; ++c)
+		rgb = (rgb << 8) | static_cast<std::uint32_t>(stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f);
+	return rgb;
+}
+
+PreviewRenderer::PreviewRenderer()
+	: _image(PreviewWidth, PreviewHeight), _columns(PreviewStripWidth)
+{
+}
+
+const PreviewImage& PreviewRenderer::Render(const FumenTimeline& t)
+{
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+	const std::vector<TimelineShousetsu>& shousetsus = t.GetShousetsus();
+
+	_image.Fill(BackgroundColor);
+	std::fill(_columns.begin(), _columns.end(), 0);
+
+	double length = t.GetLength();
+	double scale = length > 0 ? PreviewStripWidth / length : 0;
+
+	int panels[16] = { 0 };
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i) {
+		int x = std::min(static_cast<int>(i->time * scale), PreviewStripWidth - 1);
+		_columns[x] += CountKeys(i->keys);
+		for (std::uint16_t keys = i->keys; keys != 0; keys &= keys - 1) {
+			int p = 0;
+			while (!(keys & (1 << p)))
+				++p;
+			++panels[p];
+		}
+	}
+
+	//bar grid, lines closer than 2 pixels to the previous one are left out
+	int lastLine = -2;
+	for (auto i = shousetsus.cbegin(), e = shousetsus.cend(); i != e; ++i) {
+		int x = static_cast<int>(i->time * scale);
+		if (x - lastLine >= 2) {
+			_image.FillRect(x, 0, 1, PreviewHeight, GridColor);
+			lastLine = x;
+		}
+	}
+
+	int maxColumn = *std::max_element(_columns.begin(), _columns.end());
+	for (int x = 0; x < PreviewStripWidth; ++x) {
+		if (_columns[x] == 0)
+			continue;
+		double v = static_cast<double>(_columns[x]) / maxColumn;
+		int h = std::max(static_cast<int>(v * (PreviewHeight - 4)), 1);
+		_image.FillRect(x, PreviewHeight - h, 1, h, Ramp(v));
+	}
+
+	int maxPanel = *std::max_element(panels, panels + 16);
+	int cell = PreviewHeight / 4;
+	_image.FillRect(PreviewStripWidth, 0, PreviewHeight, PreviewHeight, HeatmapBorderColor);
+	for (int p = 0; p < 16; ++p) {
+		double v = maxPanel > 0 ? static_cast<double>(panels[p]) / maxPanel : 0;
+		_image.FillRect(PreviewStripWidth + (p % 4) * cell + 1, (p / 4) * cell + 1, cell - 2, cell - 2, Ramp(v));
+	}
+
+	return _image;
+}
+
+const std::string& PreviewRenderer::Encode(bool ppm)
+{
+	if (ppm)
+		EncodePpm(_image, _bytes);
+	else
+		EncodePng(_image, _bytes);
+	return _bytes;
+}
+
+static std::string GetContentHash(const std::string& bytes, bool ppm)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(bytes.data(), bytes.size());
+
+	std::ostringstream s;
+	s << crc.checksum() << ' ' << bytes.size() << ' ' << PreviewVersion << (ppm ? " ppm" : " png");
+	return s.str();
+}
+
+static std::string ReadSidecar(const std::wstring& file)
+{
+	std::fstream fs(file.c_str(), std::ios::in);
+	std::string line;
+	std::getline(fs, line);
+	return line;
+}
+
+static bool WriteBytes(const std::wstring& file, const std::string& bytes)
+{
+	std::fstream fs(file.c_str(), std::ios::out | std::ios::binary);
+	fs.write(bytes.data(), bytes.size());
+	fs.close();
+	return !fs.fail();
+}
+
+RenderStats RenderPreviews(const std::wstring& inputDir, const std::wstring& outputDir, bool ppm, int nThreads, std::ostream& log)
+{
+	using namespace std;
+
+	WarmUpStatics();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	vector<wstring> files;
+	ListFiles(inputDir, L".txt", false, files);
+
+	atomic<size_t> next(0);
+	atomic<int> nRendered(0), nSkipped(0), nFailed(0);
+	mutex logMutex;
+	vector<thread> workers;
+	for (int n = 0; n < max(nThreads, 1); ++n) {
+		workers.push_back(thread([&]() {
+			PreviewRenderer renderer;
+			FumenTimeline t;
+			string bytes;
+			for (size_t i; (i = next++) < files.size(); ) {
+				try {
+					if (!ReadFileBytes(files[i], bytes))
+						throw MyException("Cannot open input file!");
+
+					wstring output = JoinPath(outputDir, GetFumenName(GetBaseName(files[i])) + (ppm ? L".ppm" : L".png"));
+					wstring sidecar = output + L".hash";
+					string hash = GetContentHash(bytes, ppm);
+					if (GetFileMTime(output) != -1 && ReadSidecar(sidecar) == hash) {
+						++nSkipped;
+						continue;
+					}
+
+					t.Clear();
+					ParseFumenBytes(bytes, t);
+					renderer.Render(t);
+
+					//the sidecar goes last, an interrupted run renders the fumen again
+					if (!WriteBytes(output, renderer.Encode(ppm)) || !WriteBytes(sidecar, hash + "\n"))
+						throw MyException("Cannot write output file!");
+					++nRendered;
+				} catch (exception& e) {
+					lock_guard<mutex> lock(logMutex);
+					log << ToUtf8(files[i]) << ": " << e.what() << endl;
+					++nFailed;
+				}
+			}
+		}));
+	}
+	for (auto i = workers.begin(), e = workers.end(); i != e; ++i)
+		i->join();
+
+	RenderStats stats;
+	stats.rendered = nRendered;
+	stats.skipped = nSkipped;
+	stats.failed = nFailed;
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return stats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "FumenTimeline.h"
+#include "PreviewImage.h"
+
+#include <boost/utility.hpp>
+#include <string>
+#include <vector>
+#include <ostream>
+
+//every preview has the same size: the note density over time with the bar grid behind it,
+//and the 4x4 heatmap of keys per panel on the right
+const int PreviewStripWidth = 512;
+const int PreviewHeight = 128;
+const int PreviewWidth = PreviewStripWidth + PreviewHeight;
+
+//renders one timeline after another into the same buffers, so nothing is allocated per note or per fumen.
+//use one renderer per thread
+class PreviewRenderer : boost::noncopyable {
+		PreviewImage _image;
+		std::vector<int> _columns; //keys per strip column
+		std::string _bytes;
+	public:
+		PreviewRenderer();
+
+		const PreviewImage& Render(const FumenTimeline& t);
+		//the last render as png or ppm
+		const std::string& Encode(bool ppm);
+};
+
+struct RenderStats {
+	int rendered;
+	int skipped;
+	int failed;
+	double seconds;
+};
+
+//write a preview for every .txt in inputDir on nThreads threads.
+//next to each preview a .hash file records the fumen bytes it was made from, unchanged fumens are skipped
+RenderStats RenderPreviews(const std::wstring& inputDir, const std::wstring& outputDir, bool ppm, int nThreads, std::ostream& log);
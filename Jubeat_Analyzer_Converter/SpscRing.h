@@ -0,0 +1,57 @@
+#pragma once
+
+#include <boost/utility.hpp>
+#include <vector>
+#include <atomic>
+
+//lock-free ring for exactly one producer thread and one consumer thread.
+//neither side ever waits, TryPush fails when the ring is full and TryPop when it is empty
+template<class T>
+class SpscRing : boost::noncopyable {
+		std::vector<T> _items;
+		std::size_t _mask;
+
+		//each index is written by one side only, and kept on its own cache line
+		char _pad0[64];
+		std::atomic<std::size_t> _head; //next slot to pop
+		char _pad1[64];
+		std::atomic<std::size_t> _tail; //next slot to push
+		char _pad2[64];
+	public:
+		//capacity is rounded up to a power of two
+		SpscRing(std::size_t capacity) : _head(0), _tail(0)
+		{
+			std::size_t n = 2;
+			while (n < capacity)
+				n <<= 1;
+			_items.resize(n);
+			_mask = n - 1;
+		}
+
+		bool TryPush(const T& item)
+		{
+			std::size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head.load(std::memory_order_acquire) > _mask)
+				return false;
+
+			_items[tail & _mask] = item;
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool TryPop(T& item)
+		{
+			std::size_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail.load(std::memory_order_acquire))
+				return false;
+
+			item = _items[head & _mask];
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		std::size_t GetCapacity() const
+		{
+			return _mask + 1;
+		}
+};
@@ -0,0 +1,143 @@
+#include "YubiosiWriter.h"
+#include "FumenLoader.h"
+#include "MyException.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <exception>
+#include <cwchar>
+
+#include <boost/crc.hpp>
+
+void ScaleYubiosiVariants(const FumenTimeline& t, const std::vector<double>& speeds, std::vector<YubiosiVariant>& variants)
+{
+	const std::vector<TimelineHaku>& hakus = t.GetHakus();
+	const std::vector<TimelineShousetsu>& shousetsus = t.GetShousetsus();
+
+	//one entry per key: seconds into its bar at speed 1 and the bar
+	std::vector<double> baseTimes;
+	std::vector<int> baseShousetsus;
+	baseTimes.reserve(t.GetKeysCount());
+	baseShousetsus.reserve(t.GetKeysCount());
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i) {
+		int n = CountKeys(i->keys);
+		baseTimes.insert(baseTimes.end(), n, 60 * i->num / shousetsus[i->shousetsu].tempo);
+		baseShousetsus.insert(baseShousetsus.end(), n, i->shousetsu);
+	}
+
+	int nTimes = baseTimes.size();
+	const double* src = nTimes == 0 ? 0 : &baseTimes[0];
+	const int* srcShousetsu = nTimes == 0 ? 0 : &baseShousetsus[0];
+
+	//the same divisions and sums as converting at each speed, so the truncated milliseconds do not change
+	std::vector<double> starts(shousetsus.size());
+	variants.resize(speeds.size());
+	for (int v = 0, ve = speeds.size(); v < ve; ++v) {
+		YubiosiVariant& var = variants[v];
+		double speed = speeds[v];
+
+		double current = 0;
+		for (std::size_t s = 0; s < shousetsus.size(); ++s) {
+			starts[s] = current;
+			current += 60 * shousetsus[s].beat / shousetsus[s].tempo / speed;
+		}
+
+		var.speed = speed;
+		var.length = int(current * 1000) + 500;
+		var.offset = int(t.GetOffset() / speed);
+		var.times.resize(nTimes);
+
+		int* dst = nTimes == 0 ? 0 : &var.times[0];
+		for (int i = 0; i < nTimes; ++i)
+			dst[i] = int((src[i] / speed + starts[srcShousetsu[i]]) * 1000);
+	}
+}
+
+void SaveYubiosiToStream(std::wostream& s, const wchar_t* name, const FumenTimeline& t, const YubiosiVariant& v)
+{
+	using namespace std;
+
+	s << name << endl; //name
+	boost::crc_32_type crc;
+	crc.process_block(name, name + wcslen(name));
+	s << L"key" << crc() << endl; //key
+	s << 15000 << endl; //bpm
+	s << v.length << endl; //length
+	s << v.offset << endl; //offset
+	s << t.GetKeysCount() << endl; //keys
+
+	for (auto i = v.times.cbegin(), e = v.times.cend(); i != e; ++i)
+		s << *i << L'\n';
+
+	const vector<TimelineHaku>& hakus = t.GetHakus();
+	for (auto i = hakus.cbegin(), e = hakus.cend(); i != e; ++i)
+		for (int k = 0; k < 16; ++k)
+			if ((i->keys >> k) & 1)
+				s << (1 << k) << L'\n';
+	s.flush();
+}
+
+void SaveYubiosiToBytes(const FumenTimeline& t, const YubiosiVariant& v, const std::wstring& name, std::string& bytes)
+{
+	std::wostringstream s;
+	SaveYubiosiToStream(s, name.c_str(), t, v);
+	bytes = ToUtf8(s.str());
+}
+
+void SaveYubiosiFile(const FumenTimeline& t, const YubiosiVariant& v, const std::wstring& fileName)
+{
+	std::wfstream fs(fileName.c_str(), std::ios::out);
+	if (!fs)
+		throw MyException("Cannot open output file!");
+	fs.imbue(GetUtf8Locale());
+	SaveYubiosiToStream(fs, GetFumenName(fileName).c_str(), t, v);
+}
+
+void SaveYubiosiVariants(const FumenTimeline& t, const std::vector<double>& speeds, const std::vector<std::wstring>& fileNames)
+{
+	using namespace std;
+
+	if (speeds.size() != fileNames.size())
+		throw MyException("Internal Error: count of speeds and output files mismatch.");
+
+	vector<YubiosiVariant> variants;
+	ScaleYubiosiVariants(t, speeds, variants);
+
+	//statics are not thread-safe on vc12, initialize them here
+	GetUtf8Locale();
+	GetFumenName(fileNames.empty() ? L"" : fileNames[0]);
+
+	vector<exception_ptr> errors(variants.size());
+	vector<thread> writers;
+	for (int v = 0, ve = variants.size(); v < ve; ++v) {
+		writers.push_back(thread([&, v]() {
+			try {
+				SaveYubiosiFile(t, variants[v], fileNames[v]);
+			} catch (...) {
+				errors[v] = current_exception();
+			}
+		}));
+	}
+
+	for (auto i = writers.begin(), e = writers.end(); i != e; ++i)
+		i->join();
+
+	for (auto i = errors.cbegin(), e = errors.cend(); i != e; ++i)
+		if (*i)
+			rethrow_exception(*i);
+}
+
+std::wstring GetVariantFileName(const std::wstring& fileName, double speed)
+{
+	std::wostringstream r;
+
+	std::wstring::size_type slash = fileName.find_last_of(L"\\/");
+	std::wstring::size_type dot = fileName.rfind(L'.');
+	if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash))
+		r << fileName << L'_' << speed;
+	else
+		r << fileName.substr(0, dot) << L'_' << speed << fileName.substr(dot);
+
+	return r.str();
+}
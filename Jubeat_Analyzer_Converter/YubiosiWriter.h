@@ -0,0 +1,33 @@
+#pragma once
+
+#include "FumenTimeline.h"
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+//scaled yubiosi data of one playback rate
+struct YubiosiVariant {
+	double speed;
+	int length;
+	int offset;
+	std::vector<int> times;
+};
+
+//scale the timeline into every speed from one pass over the key times, with the same arithmetic as
+//converting at that speed
+void ScaleYubiosiVariants(const FumenTimeline& t, const std::vector<double>& speeds, std::vector<YubiosiVariant>& variants);
+
+void SaveYubiosiToStream(std::wostream& s, const wchar_t* name, const FumenTimeline& t, const YubiosiVariant& v);
+
+//yubiosi file content encoded in utf-8
+void SaveYubiosiToBytes(const FumenTimeline& t, const YubiosiVariant& v, const std::wstring& name, std::string& bytes);
+
+//write a yubiosi file, the fumen name comes from the file name
+void SaveYubiosiFile(const FumenTimeline& t, const YubiosiVariant& v, const std::wstring& fileName);
+
+//write one yubiosi file per speed, files are written concurrently
+void SaveYubiosiVariants(const FumenTimeline& t, const std::vector<double>& speeds, const std::vector<std::wstring>& fileNames);
+
+//output_0.9.txt for output.txt and speed 0.9
+std::wstring GetVariantFileName(const std::wstring& fileName, double speed);
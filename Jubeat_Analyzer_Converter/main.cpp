@@ -6,6 +6,7 @@
 #include <fstream>
 
 #include <boost/crc.hpp>
+#include <boost/lexical_cast.hpp>
 
 using namespace std;
 class YubiosiConverter : public FumenParser {
@@ -96,58 +97,547 @@ class YubiosiConverter : public FumenParser {
 		}
 };
 
-#include <locale>
-#include <regex>
-#include <codecvt>
+#include "FumenLoader.h"
+#include "FumenTimeline.h"
+#include "YubiosiWriter.h"
+#include "FumenServer.h"
+#include "ArchiveConverter.h"
+#include "BatchConverter.h"
+#include "FileUtil.h"
+#include "FumenCatalog.h"
+#include "FumenFingerprint.h"
+#include "PatternIndex.h"
+#include "FumenPlayer.h"
+#include "FumenDiff.h"
+#include "PreviewRenderer.h"
+#include "JubeatAnalyzerWriter.h"
 
-int wmain(int argc, wchar_t* argv[])
+#include <cwchar>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+//-speeds 0.8,0.9,1.1 input output
+//parse once, then write output_0.8.txt, output_0.9.txt ... from the same timeline
+static int SpeedVariantsMain(int argc, wchar_t* argv[])
+{
+	if (argc != 5) {
+		cerr << "run this program with -speeds list input output, list looks like 0.8,0.9,1.1" << endl;
+		return 1;
+	}
+
+	vector<double> speeds;
+	wstringstream speedList(argv[2]);
+	wstring speed;
+	while (getline(speedList, speed, L',')) {
+		double sp = boost::lexical_cast<double>(speed);
+		if (sp <= 0)
+			throw MyException("Speed must be positive!");
+		speeds.push_back(sp);
+	}
+
+	FumenTimeline fp;
+
+	fstream fs(argv[3], std::ios::in);
+	vector<wstring> lines;
+	ReadFumenLines(fs, lines);
+	fp.LoadString(lines);
+	fs.close();
+
+	vector<wstring> fileNames;
+	for (auto i = speeds.cbegin(), e = speeds.cend(); i != e; ++i)
+		fileNames.push_back(GetVariantFileName(argv[4], *i));
+
+	SaveYubiosiVariants(fp, speeds, fileNames);
+	return 0;
+}
+
+//-server [-stdio | pipe]
+//serve requests on the default named pipe for -client, on another pipe, or on stdin/stdout
+static int ServerMain(int argc, wchar_t* argv[])
+{
+	FumenServer server(256);
+
+	if (argc > 2 && wcscmp(argv[2], L"-stdio") == 0) {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		server.ServeStream(cin, cout, std::thread::hardware_concurrency());
+		return 0;
+	}
+
+#ifdef _WIN32
+	server.ServePipe(argc > 2 ? argv[2] : DefaultServerPipeName);
+	return 0;
+#else
+	cerr << "named pipe server is only available on windows, use -server -stdio" << endl;
+	return 1;
+#endif
+}
+
+#ifdef _WIN32
+static wstring GetFullPath(const wchar_t* fileName)
 {
-	static locale jpLoc("japanese", std::locale::ctype);
-	static locale defLoc("", std::locale::ctype);
-	static locale utf8Loc(defLoc, new std::codecvt_utf8<wchar_t>());
+	wchar_t buf[MAX_PATH];
+	DWORD len = GetFullPathNameW(fileName, MAX_PATH, buf, NULL);
+	if (len == 0 || len >= MAX_PATH)
+		return fileName;
+	return buf;
+}
+#endif
+
+//-client input output [speed]
+//convert through a running -server, or locally when no server is listening
+static int ClientMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4 && argc != 5) {
+		cerr << "run this program with -client input output [speed]" << endl;
+		return 1;
+	}
+
+	vector<string> fields;
+	fields.push_back("convert");
+#ifdef _WIN32
+	fields.push_back(ToUtf8(GetFullPath(argv[2])));
+	fields.push_back(ToUtf8(GetFullPath(argv[3])));
+#else
+	fields.push_back(ToUtf8(argv[2]));
+	fields.push_back(ToUtf8(argv[3]));
+#endif
+	if (argc == 5)
+		fields.push_back(ToUtf8(argv[4]));
 
-	if (argc != 3) {
-		cerr << "run this program with 2 parameters: input and output filename" << endl;
+	string response;
+#ifdef _WIN32
+	string request;
+	for (auto i = fields.cbegin(), e = fields.cend(); i != e; ++i)
+		request += (i == fields.cbegin() ? "" : "\t") + *i;
+	if (!SendServerRequest(DefaultServerPipeName, request, response))
+#endif
+	{
+		FumenServer local(0);
+		try {
+			response = local.HandleRequest(fields, string());
+		} catch (exception& e) {
+			response = string("error\t") + e.what();
+		}
+	}
+
+	if (response.compare(0, 5, "error") == 0) {
+		cerr << response.substr(std::min<size_t>(6, response.length())) << endl;
 		return 1;
 	}
-	
+	return 0;
+}
+
+//-archive input.zip output [speed]
+//convert every .txt of a zip or tar, output is a .zip, a .tar or a directory
+static int ArchiveMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4 && argc != 5) {
+		cerr << "run this program with -archive input.zip output [speed]" << endl;
+		return 1;
+	}
+
+	double speed = argc == 5 ? boost::lexical_cast<double>(argv[4]) : 1;
+	if (speed <= 0)
+		throw MyException("Speed must be positive!");
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 2);
+	return ConvertArchive(argv[2], argv[3], speed, nThreads / 2, nThreads - nThreads / 2) == 0 ? 0 : 1;
+}
+
+//-batch input output [-speed x] [-readers n] [-workers n] [-writers n] [-queue n]
+//input is a directory of .txt files and output a directory, or input is a list file
+static int BatchMain(int argc, wchar_t* argv[])
+{
+	if (argc < 4 || argc % 2 != 0) {
+		cerr << "run this program with -batch inputdir outputdir, or -batch list.txt -" << endl;
+		cerr << "options: -speed x -readers n -workers n -writers n -queue n" << endl;
+		return 1;
+	}
+
+	int nCores = std::max<int>(std::thread::hardware_concurrency(), 1);
+	int nReaders = 4, nWorkers = nCores, nWriters = 2, queueCapacity = nCores * 4;
+	double speed = 1;
+
+	for (int i = 4; i + 1 < argc; i += 2) {
+		if (wcscmp(argv[i], L"-speed") == 0)
+			speed = boost::lexical_cast<double>(argv[i + 1]);
+		else if (wcscmp(argv[i], L"-readers") == 0)
+			nReaders = boost::lexical_cast<int>(argv[i + 1]);
+		else if (wcscmp(argv[i], L"-workers") == 0)
+			nWorkers = boost::lexical_cast<int>(argv[i + 1]);
+		else if (wcscmp(argv[i], L"-writers") == 0)
+			nWriters = boost::lexical_cast<int>(argv[i + 1]);
+		else if (wcscmp(argv[i], L"-queue") == 0)
+			queueCapacity = boost::lexical_cast<int>(argv[i + 1]);
+		else
+			throw MyException("Unknown batch option!");
+	}
+	if (speed <= 0)
+		throw MyException("Speed must be positive!");
+	if (queueCapacity <= 0)
+		throw MyException("Queue capacity must be positive!");
+
+	vector<BatchJob> jobs;
+	if (IsDirectory(argv[2]))
+		GetDirectoryBatchJobs(argv[2], argv[3], speed, jobs);
+	else
+		GetListBatchJobs(argv[2], jobs);
+
+	BatchConverter bc(nReaders, nWorkers, nWriters, queueCapacity);
+	BatchStats stats = bc.Run(jobs);
+	PrintBatchStats(cout, stats);
+	return stats.failed == 0 ? 0 : 1;
+}
+
+//-catalog librarydir index
+//parse every .txt under librarydir into a catalog index, only changed files are parsed again
+static int CatalogMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4) {
+		cerr << "run this program with -catalog librarydir index" << endl;
+		return 1;
+	}
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+	int nParsed = BuildCatalog(argv[2], argv[3], nThreads, cerr);
+	cout << "parsed: " << nParsed << endl;
+	return 0;
+}
+
+static void ParseRange(wchar_t* lo, wchar_t* hi, double& minValue, double& maxValue)
+{
+	if (wcscmp(lo, L"-") != 0)
+		minValue = boost::lexical_cast<double>(lo);
+	if (wcscmp(hi, L"-") != 0)
+		maxValue = boost::lexical_cast<double>(hi);
+}
+
+//-query index [-tempo lo hi] [-keys lo hi] [-length lo hi] [-density lo hi] [-music text]
+//"-" leaves a bound open, length is in seconds and density in keys per second
+static int QueryMain(int argc, wchar_t* argv[])
+{
+	if (argc < 3) {
+		cerr << "run this program with -query index [-tempo lo hi] [-keys lo hi] [-length lo hi] [-density lo hi] [-music text]" << endl;
+		return 1;
+	}
+
+	CatalogFilter f;
+	for (int i = 3; i < argc; ) {
+		if (wcscmp(argv[i], L"-music") == 0 && i + 1 < argc) {
+			f.music = ToUtf8(argv[i + 1]);
+			i += 2;
+			continue;
+		}
+		if (i + 2 >= argc)
+			throw MyException("Missing query range!");
+
+		if (wcscmp(argv[i], L"-tempo") == 0) {
+			ParseRange(argv[i + 1], argv[i + 2], f.minTempo, f.maxTempo);
+		} else if (wcscmp(argv[i], L"-keys") == 0) {
+			double lo = f.minKeys, hi = f.maxKeys;
+			ParseRange(argv[i + 1], argv[i + 2], lo, hi);
+			f.minKeys = int(lo);
+			f.maxKeys = int(hi);
+		} else if (wcscmp(argv[i], L"-length") == 0) {
+			ParseRange(argv[i + 1], argv[i + 2], f.minLength, f.maxLength);
+		} else if (wcscmp(argv[i], L"-density") == 0) {
+			ParseRange(argv[i + 1], argv[i + 2], f.minDensity, f.maxDensity);
+		} else
+			throw MyException("Unknown query option!");
+		i += 3;
+	}
+
+	CatalogView view;
+	if (!view.Open(argv[2]))
+		throw MyException("Cannot open catalog index!");
+
+	vector<size_t> rows;
+	view.Query(f, rows);
+	for (auto i = rows.cbegin(), e = rows.cend(); i != e; ++i) {
+		CatalogRecord r;
+		view.GetRecord(*i, r);
+		cout << r.path << '\t' << r.minTempo << '-' << r.maxTempo << '\t' << r.keys
+			<< '\t' << r.length << "s\t" << r.avgDensity << '/' << r.peakDensity << '\t' << r.musicFile << endl;
+	}
+	return 0;
+}
+
+//-dupes librarydir [threshold]
+//group fumens with the same timeline, or estimated at least threshold (default 0.8) similar
+static int DupesMain(int argc, wchar_t* argv[])
+{
+	if (argc != 3 && argc != 4) {
+		cerr << "run this program with -dupes librarydir [threshold]" << endl;
+		return 1;
+	}
+
+	double threshold = argc == 4 ? boost::lexical_cast<double>(argv[3]) : 0.8;
+
+	vector<wstring> files;
+	ListFiles(argv[2], L".txt", true, files);
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+	FindDuplicateFumens(files, threshold, nThreads, cout, cerr);
+	return 0;
+}
+
+//-patterns librarydir index
+//index the step patterns of every .txt under librarydir
+static int PatternsMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4) {
+		cerr << "run this program with -patterns librarydir index" << endl;
+		return 1;
+	}
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+	int nIndexed = BuildPatternIndex(argv[2], argv[3], nThreads, cerr);
+	cout << "indexed: " << nIndexed << endl;
+	return 0;
+}
+
+//-find index pattern [-exact]
+//every place the pattern, or one of its rotations and mirrors, appears. -exact matches the pattern as written
+static int FindMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4 && !(argc == 5 && wcscmp(argv[4], L"-exact") == 0)) {
+		cerr << "run this program with -find index pattern [-exact]" << endl;
+		return 1;
+	}
+
+	vector<std::uint16_t> pattern;
+	ParsePattern(ToUtf8(argv[3]), pattern);
+
+	PatternIndexView view;
+	if (!view.Open(argv[2]))
+		throw MyException("Cannot open pattern index!");
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<PatternHit> hits;
+	view.Find(pattern, argc == 4, hits);
+	double ms = chrono::duration<double, std::milli>(chrono::steady_clock::now() - start).count();
+
+	for (auto i = hits.cbegin(), e = hits.cend(); i != e; ++i) {
+		cout << view.GetPath(i->fumen) << '\t' << i->shousetsu + 1 << '\t' << i->num
+			<< '\t' << i->time << "s\t" << i->symmetry << endl;
+	}
+	cerr << hits.size() << " hits in " << ms << "ms" << endl;
+	return 0;
+}
+
+//-play input [rate] [-from seconds] [-print]
+//fire the events of a fumen in real time and report how late they fired
+static int PlayMain(int argc, wchar_t* argv[])
+{
+	if (argc < 3) {
+		cerr << "run this program with -play input [rate] [-from seconds] [-print]" << endl;
+		return 1;
+	}
+
+	double rate = 1, from = 0;
+	bool print = false, seek = false;
+	for (int i = 3; i < argc; ++i) {
+		if (wcscmp(argv[i], L"-from") == 0 && i + 1 < argc) {
+			from = boost::lexical_cast<double>(argv[++i]);
+			seek = true;
+		}
+		else if (wcscmp(argv[i], L"-print") == 0)
+			print = true;
+		else
+			rate = boost::lexical_cast<double>(argv[i]);
+	}
+
+	string bytes;
+	if (!ReadFileBytes(argv[2], bytes))
+		throw MyException("Cannot open input file!");
+	FumenTimeline t;
+	ParseFumenBytes(bytes, t);
+
+	FumenPlayer player(t);
+	player.SetRate(rate);
+	if (seek)
+		player.Seek(from);
+	player.Start();
+	player.Play();
+
+	PlaybackDelivery d;
+	for (;;) {
+		//read before polling, so an empty ring after the last event really is the end
+		bool finished = player.IsFinished();
+		if (player.Poll(d)) {
+			if (print) {
+				cout << d.event.time << '\t' << d.event.shousetsu + 1 << '\t' << d.event.keys
+					<< '\t' << d.lateness * 1e6 << "us" << endl;
+			}
+		} else if (finished)
+			break;
+		else
+			std::this_thread::yield();
+	}
+	player.Stop();
+
+	JitterStats s = player.GetJitterStats();
+	cout << "fired: " << s.fired << " dropped: " << s.dropped << endl;
+	cout << "lateness mean " << s.mean * 1e6 << "us, median " << s.p50 * 1e6 << "us, 99% " << s.p99 * 1e6
+		<< "us, max " << s.max * 1e6 << "us" << endl;
+	return 0;
+}
+
+//-diff old new
+//compare the notes of two versions of a fumen bar by bar, layout and comments do not matter
+static int DiffMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4) {
+		cerr << "run this program with -diff old new" << endl;
+		return 1;
+	}
+
+	WarmUpStatics();
+
+	FumenTimeline timelines[2];
+	std::exception_ptr errors[2];
+	std::thread loaders[2];
+	for (int i = 0; i < 2; ++i) {
+		loaders[i] = std::thread([&, i]() {
+			try {
+				string bytes;
+				if (!ReadFileBytes(argv[2 + i], bytes))
+					throw MyException("Cannot open input file!");
+				ParseFumenBytes(bytes, timelines[i]);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+	for (int i = 0; i < 2; ++i)
+		loaders[i].join();
+	for (int i = 0; i < 2; ++i)
+		if (errors[i])
+			std::rethrow_exception(errors[i]);
+
+	PrintFumenDiff(timelines[0], timelines[1], cout);
+	return 0;
+}
+
+//-render inputdir outputdir [-ppm]
+//a density strip and panel heatmap image for every .txt of inputdir, unchanged fumens are skipped
+static int RenderMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4 && !(argc == 5 && wcscmp(argv[4], L"-ppm") == 0)) {
+		cerr << "run this program with -render inputdir outputdir [-ppm]" << endl;
+		return 1;
+	}
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+	RenderStats stats = RenderPreviews(argv[2], argv[3], argc == 5, nThreads, cerr);
+	cout << "rendered: " << stats.rendered << " skipped: " << stats.skipped << " failed: " << stats.failed
+		<< " in " << stats.seconds << "s" << endl;
+	return stats.failed == 0 ? 0 : 1;
+}
+
+//-normalize input output [-two]
+//rewrite a fumen, or every .txt of a directory, in the canonical one column (or two column) layout
+static int NormalizeMain(int argc, wchar_t* argv[])
+{
+	if (argc != 4 && !(argc == 5 && wcscmp(argv[4], L"-two") == 0)) {
+		cerr << "run this program with -normalize input output [-two]" << endl;
+		return 1;
+	}
+
+	bool twoColumn = argc == 5;
+	if (!IsDirectory(argv[2])) {
+		NormalizeFumen(argv[2], argv[3], twoColumn);
+		return 0;
+	}
+
+	int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+	NormalizeStats stats = NormalizeFumens(argv[2], argv[3], twoColumn, nThreads, cerr);
+	cout << "normalized: " << stats.normalized << " failed: " << stats.failed << " in " << stats.seconds << "s" << endl;
+	return stats.failed == 0 ? 0 : 1;
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
 	try {
+		if (argc > 1 && wcscmp(argv[1], L"-speeds") == 0)
+			return SpeedVariantsMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-server") == 0)
+			return ServerMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-client") == 0)
+			return ClientMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-archive") == 0)
+			return ArchiveMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-batch") == 0)
+			return BatchMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-catalog") == 0)
+			return CatalogMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-query") == 0)
+			return QueryMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-dupes") == 0)
+			return DupesMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-patterns") == 0)
+			return PatternsMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-find") == 0)
+			return FindMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-play") == 0)
+			return PlayMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-diff") == 0)
+			return DiffMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-render") == 0)
+			return RenderMain(argc, argv);
+		if (argc > 1 && wcscmp(argv[1], L"-normalize") == 0)
+			return NormalizeMain(argc, argv);
+
+		if (argc != 3) {
+			cerr << "run this program with 2 parameters: input and output filename" << endl;
+			cerr << "or: -speeds 0.8,0.9,1.1 input output" << endl;
+			cerr << "or: -server [-stdio | pipe]" << endl;
+			cerr << "or: -client input output [speed]" << endl;
+			cerr << "or: -archive input.zip output.zip|output.tar|directory [speed]" << endl;
+			cerr << "or: -batch inputdir outputdir [options], or -batch list.txt - [options]" << endl;
+			cerr << "or: -catalog librarydir index" << endl;
+			cerr << "or: -query index [-tempo lo hi] [-keys lo hi] [-length lo hi] [-density lo hi] [-music text]" << endl;
+			cerr << "or: -dupes librarydir [threshold]" << endl;
+			cerr << "or: -patterns librarydir index" << endl;
+			cerr << "or: -find index pattern [-exact]" << endl;
+			cerr << "or: -play input [rate] [-from seconds] [-print]" << endl;
+			cerr << "or: -diff old new" << endl;
+			cerr << "or: -render inputdir outputdir [-ppm]" << endl;
+			cerr << "or: -normalize input output [-two]" << endl;
+			return 1;
+		}
+
 		//Fumen2XML fp;
 		YubiosiConverter fp;
 
 		//fp.SetSpeed(0.9);
-		
-		static const wregex fnReg(L"([^\\\\]*?\\\\)?(.+?)\\.[Tt][Xx][Tt]");
-
-		wcmatch fnMatch;
 
-		wstring name;
-		if (regex_match(argv[2], fnMatch, fnReg)) {
-			name = fnMatch[2].str();
-		} else {
-			name = argv[2];
-		}
+		wstring name = GetFumenName(argv[2]);
 
 		fstream fs(argv[1], std::ios::in);
 
 		vector<wstring> lines;
 		//read lines
-		while(!fs.eof()) {
-			string line;
-			getline(fs, line);
-
-			if (line.length() > 3 && line[0] == 'm')
-				lines.push_back(EncodingConv(line, defLoc));
-			else
-				lines.push_back(EncodingConv(line, jpLoc));
-		}
+		ReadFumenLines(fs, lines);
 
 		fp.LoadString(lines);
 		fs.close();
 
 		wfstream fs2(argv[2], std::ios::out);
-		//fs2.imbue(jpLoc);
-		fs2.imbue(utf8Loc);
+		//fs2.imbue(GetJapaneseLocale());
+		fs2.imbue(GetUtf8Locale());
 
 		fp.SaveToStream( fs2, name.c_str() );
 		return 0;